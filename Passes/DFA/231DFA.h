@@ -35,6 +35,7 @@
 #include "llvm/Support/raw_ostream.h"
 #include <deque>
 #include <map>
+#include <set>
 #include <utility>
 #include <vector>
 
@@ -92,6 +93,9 @@ class DataFlowAnalysis {
 		std::map<Instruction *, unsigned> InstrToIndex;
 		// Edge to information map
 		std::map<Edge, Info *> EdgeToInfo;
+		// Index to the sources of its incoming edges / the destinations of its outgoing edges
+		std::map<unsigned, std::set<unsigned>> IncomingOf;
+		std::map<unsigned, std::set<unsigned>> OutgoingOf;
 		// The bottom of the lattice
 		Info Bottom;
 		// The initial state of the analysis
@@ -137,10 +141,10 @@ class DataFlowAnalysis {
 		void getIncomingEdges(unsigned index, std::vector<unsigned> * IncomingEdges) {
 			assert(IncomingEdges->size() == 0 && "IncomingEdges should be empty.");
 
-			for (auto const &it : EdgeToInfo) {
-				if (it.first.second == index)
-					IncomingEdges->push_back(it.first.first);
-			}
+			// same order as a scan of EdgeToInfo, without visiting every edge of the function
+			auto it = IncomingOf.find(index);
+			if (it != IncomingOf.end())
+				IncomingEdges->assign(it->second.begin(), it->second.end());
 
 			return;
 		}
@@ -153,10 +157,9 @@ class DataFlowAnalysis {
 		void getOutgoingEdges(unsigned index, std::vector<unsigned> * OutgoingEdges) {
 			assert(OutgoingEdges->size() == 0 && "OutgoingEdges should be empty.");
 
-			for (auto const &it : EdgeToInfo) {
-				if (it.first.first == index)
-					OutgoingEdges->push_back(it.first.second);
-			}
+			auto it = OutgoingOf.find(index);
+			if (it != OutgoingOf.end())
+				OutgoingEdges->assign(it->second.begin(), it->second.end());
 
 			return;
 		}
@@ -168,8 +171,11 @@ class DataFlowAnalysis {
 		 */
 		void addEdge(Instruction * src, Instruction * dst, Info * content) {
 			Edge edge = std::make_pair(InstrToIndex[src], InstrToIndex[dst]);
-			if (EdgeToInfo.count(edge) == 0)
+			if (EdgeToInfo.count(edge) == 0) {
 				EdgeToInfo[edge] = content;
+				IncomingOf[edge.second].insert(edge.first);
+				OutgoingOf[edge.first].insert(edge.second);
+			}
 			return;
 		}
 
@@ -314,6 +320,10 @@ class DataFlowAnalysis {
 		return this->EdgeToInfo[edge];
 	}
 
+	const std::map<Edge, Info *> & getEdgeToInfo(){
+		return this->EdgeToInfo;
+	}
+
 	unsigned countInstructions(Instruction* I){
 		return this->InstrToIndex.count(I);
 	}
@@ -321,6 +331,25 @@ class DataFlowAnalysis {
 	Instruction* getInstrFromIndex(unsigned index){
 		return this->IndexToInstr[index];
 	}
+
+	//############################################################
+	// direct construction of the results
+	//############################################################
+	/*
+	 * Build the DFA CFG of func with every edge initialized to bottom, without running the worklist.
+	 * Analyses that can compute their results directly (e.g. from SSA form) call this,
+	 * fill in the edges with setInfoToEdge() and then reuse print().
+	 */
+	void initializeMap(Function * func) {
+		if (Direction)
+			initializeForwardMap(func);
+		else
+			initializeBackwardMap(func);
+	}
+
+	void setInfoToEdge(Edge edge, Info * info){
+		this->EdgeToInfo[edge] = info;
+	}
 	
     /*
      * Print out the analysis results.
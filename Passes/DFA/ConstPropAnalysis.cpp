@@ -13,6 +13,7 @@
 
         2   bool runOnSCC(CallGraphSCC &SCC)
         You'll build your CMOD data structures in this method
+        (here computeCMOD builds them for all the SCCs at once, level by level, at the end of doInitialization)
 
         The SCC will give you all the caller-callee relationship that you can use to calculate the MOD for the functions in your module.
         You'll get the LMOD[caller] and then you'll get the MOD[callee] . The union of these two things is MOD[caller]
@@ -29,7 +30,12 @@
         CMOD ---  variables modified in the body of other functions by calls
 */
 #include "231DFA.h"
+#include "ModSummary.h"
 #include "llvm/Pass.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SCCIterator.h"
 #include "llvm/Analysis/CallGraphSCCPass.h"
 #include "llvm/Analysis/CallGraph.h"
 
@@ -37,11 +43,20 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/User.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
 
 #include "llvm/IR/ConstantFolder.h" 
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
 // use LLVM's ConstantFolder to fold in unary and binary(binaryOp, cmp, select) expressions with constant operands into a constant. 
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <string>
+#include <thread>
 #include <vector>
 #include <set>
 #include <map>
@@ -49,127 +64,470 @@
 using namespace llvm;
 using namespace std;   
 
+// opt -load submission_pt4.so -cse231-constprop -cse231-constprop-threads=8 < input.ll > /dev/null
+static cl::opt<unsigned> ModThreads("cse231-constprop-threads",
+    cl::desc("Number of threads computing the MOD sets of the call-graph SCCs of a level"),
+    cl::init(1));
+
+// before/after instruction counts from cse231-csi (the rewrite happens in doFinalization, so the "after" counts come from a second run):
+// opt -load submission_pt1.so -load submission_pt4.so -cse231-csi -cse231-csi-total -cse231-constprop -cse231-constprop-transform < input.ll > output.bc
+// opt -load submission_pt1.so -cse231-csi -cse231-csi-total < output.bc > /dev/null
+static cl::opt<bool> Transform("cse231-constprop-transform",
+    cl::desc("Rewrite the IR with the constants found instead of printing them"),
+    cl::init(false));
+
+// opt -load submission_pt4.so -cse231-constprop -cse231-constprop-sccp [-cse231-constprop-transform] < input.ll > /dev/null
+static cl::opt<bool> SCCP("cse231-constprop-sccp",
+    cl::desc("Only propagate along executable CFG edges (feasible successors of constant branches and switches)"),
+    cl::init(false));
+
+// opt -load submission_pt4.so -cse231-constprop -cse231-constprop-interprocedural < input.ll > /dev/null
+// opt -load submission_pt4.so -cse231-constprop -cse231-constprop-transform -cse231-constprop-specialize < input.ll > output.bc
+static cl::opt<bool> Interprocedural("cse231-constprop-interprocedural",
+    cl::desc("Propagate constant arguments into callees and constant return values into callers"),
+    cl::init(false));
+
+static cl::opt<bool> Specialize("cse231-constprop-specialize",
+    cl::desc("Transform mode: clone callees for constant-argument tuples recurring at several call sites"),
+    cl::init(false));
+
+static cl::opt<unsigned> SpecializeBudget("cse231-constprop-specialize-budget",
+    cl::desc("Maximum number of instructions the specialized clones may add to the module"),
+    cl::init(1000));
+
+static cl::opt<unsigned> SpecializeMinCalls("cse231-constprop-specialize-min-calls",
+    cl::desc("Minimum number of call sites sharing a constant-argument tuple to specialize for it"),
+    cl::init(2));
+
+// opt -load submission_pt4.so -cse231-constprop -cse231-constprop-infer-attrs < input.ll > output.bc
+static cl::opt<bool> InferAttrs("cse231-constprop-infer-attrs",
+    cl::desc("Mark functions that write no memory readonly, functions without atomics or volatile accesses nosync, "
+             "and internal globals no function modifies constant"),
+    cl::init(false));
+
+// opt -load submission_pt4.so -cse231-constprop -cse231-constprop-annotate < input.ll > output.bc
+static cl::opt<bool> Annotate("cse231-constprop-annotate",
+    cl::desc("Attach the constants found and the MOD sets to the IR as metadata instead of printing them"),
+    cl::init(false));
+
+// cross-module MOD/MPT: write a summary per module, merge them, then analyze each module with the merged summary
+// opt -load submission_pt4.so -cse231-constprop -cse231-constprop-write-summary=a.modsum < a.ll > /dev/null
+// cse231-mod-merge a.modsum b.modsum ... -o merged.modsum
+// opt -load submission_pt4.so -cse231-constprop -cse231-constprop-summary=merged.modsum < a.ll > /dev/null
+static cl::opt<string> WriteSummary("cse231-constprop-write-summary",
+    cl::desc("Write the MOD/MPT summary of the functions the module exports to this file"),
+    cl::value_desc("filename"), cl::init(""));
+
+static cl::opt<string> ReadSummary("cse231-constprop-summary",
+    cl::desc("Take the MOD sets of declared functions from this merged MOD/MPT summary"),
+    cl::value_desc("filename"), cl::init(""));
+
+// opt -load submission_pt4.so -cse231-constprop -cse231-constprop-fold-stats < input.ll > /dev/null
+static cl::opt<bool> FoldStats("cse231-constprop-fold-stats",
+    cl::desc("Print the hit rate of the constant-folding cache after the analysis"),
+    cl::init(false));
+
 namespace {
 
-    std::set <Value*> MPTSet;   //  May-point-to set (MPT)   ---  a set of all modified global vars 
+    /*
+        Numbering of the global variables of the module, the positions of the MOD and MPT bit-sets.
+    */
+    struct GlobalNumbering {
+        vector<GlobalVariable*> values;
+        DenseMap<Value*, unsigned> ids;
+
+        void initialize(Module & M){
+            values.clear();
+            ids.clear();
+            for(GlobalVariable& glob : M.getGlobalList()){
+                ids[&glob] = values.size();
+                values.push_back(&glob);
+            }
+        }
+
+        unsigned size() const { return values.size(); }
+        unsigned getID(GlobalVariable * glob) const { return ids.find(glob)->second; }
+    } Globals;
+
+    //  May-point-to set (MPT)   ---  a set of all modified global vars 
+    BitVector MPTGlobals;           // the globals of MPT, by Globals ID
+    DenseSet<Value*> MPTValues;     // the other values of MPT
+
+    uint64_t FoldLookups = 0, FoldHits = 0;     // constant-folding cache, over all the analyses of the module
+    bool Solving = false;           // interprocedural rounds: lookups of not yet known values are expected
+    ModSummary Imported;            // the merged summary of the other modules (-cse231-constprop-summary)
+    std::map<Function*, BitVector> MODMap;    //union of LMOD and CMOD sets --- map a function to a set of global variables modified in the function
+                                              // used for inter procedure calls; every function of the module (and nullptr) has an entry
+
+    /*
+        In transform mode the facts must be sound, so an instruction that may write memory the analysis does not
+        name (a store through any pointer other than a global or an alloca, an atomic, a call that is not a CallInst
+        to a defined function or to a read-only declaration) is taken to modify every global.
+        The same holds whenever the facts leave the analysis, i.e. when they are attached to the IR as well.
+        A declaration described by the imported summary only writes unknown memory if the summary says so.
+    */
+    bool SoundFacts(){
+        return Transform || Annotate;
+    }
+
+    bool writesUnknownMemory(Instruction * I){
+        if (StoreInst* store_inst = dyn_cast<StoreInst>(I)){
+            Value* ptr = store_inst->getPointerOperand();
+            return !isa<GlobalVariable>(ptr) && !isa<AllocaInst>(ptr);
+        }
+        if (isa<AtomicRMWInst>(I) || isa<AtomicCmpXchgInst>(I)){
+            return true;
+        }
+        if (CallBase* call = dyn_cast<CallBase>(I)){
+            Function* callee = call->getCalledFunction();
+            if (callee && callee->isDeclaration() && isa<CallInst>(call)){
+                if (const FunctionModSummary* summary = Imported.get(callee->getName())){
+                    return summary->unknown;
+                }
+            }
+            return !isa<CallInst>(call) || !callee || (callee->isDeclaration() && !callee->onlyReadsMemory());
+        }
+        return false;
+    }
 
-    std::map<Function*, set <GlobalVariable*>> MODMap;    //union of LMOD and CMOD sets --- map a function to a set of global variables modified in the function
-                                                          // used for inter procedure calls 
+    void addToMPT(Value * val){
+        if (GlobalVariable* globalVar = dyn_cast<GlobalVariable>(val)){
+            MPTGlobals.set(Globals.getID(globalVar));
+        }
+        else{
+            MPTValues.insert(val);
+        }
+    }
     
+    /*
+        Dense numbering of the values tracked by ConstPropInfo, rebuilt for every function.
+        ID 0 stands for all the global variables the function does not use: no instruction of the function names
+        them, so they always share the same state, which one entry holds for all of them.
+        The globals the function uses (operands, MOD sets of its callees, the MPT globals if it stores through a
+        pointer) come next, then the other values of the function (instructions, arguments, constant expressions
+        used as store targets) on first use. An info therefore grows with the globals the function uses, not with
+        the globals of the module.
+    */
+    struct ConstPropNumbering {
+        DenseMap<Value*, unsigned> ids;
+        vector<Value*> values;
+        unsigned numGlobals = 1;                // the unused globals' entry and the used globals
+        vector<unsigned> mptIDs;                // the MPT values the function can observe, set to top by a store through a pointer
+        vector<GlobalVariable*> printOrder;     // every global of the module, in the order of their addresses (the old map order)
+
+        void initialize(Module & M){
+            printOrder.clear();
+            for(GlobalVariable& glob : M.getGlobalList()){
+                printOrder.push_back(&glob);
+            }
+            std::sort(printOrder.begin(), printOrder.end(), std::less<Value*>());
+        }
+
+        void beginFunction(Function & F){
+            ids.clear();
+            values.assign(1, nullptr);
+
+            bool storesThroughPointer = false;
+            for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I){
+                for (Use& operand : I->operands()){
+                    if (GlobalVariable* globalVar = dyn_cast<GlobalVariable>(operand)){
+                        getID(globalVar);
+                    }
+                }
+                if (CallInst* call_inst = dyn_cast<CallInst>(&*I)){
+                    for(unsigned glob : MODMap[call_inst->getCalledFunction()].set_bits()){
+                        getID(Globals.values[glob]);
+                    }
+                }
+                if (StoreInst* store_inst = dyn_cast<StoreInst>(&*I)){
+                    storesThroughPointer |= isa<LoadInst>(store_inst->getPointerOperand());
+                }
+            }
+
+            mptIDs.clear();
+            if(storesThroughPointer){
+                for(unsigned glob : MPTGlobals.set_bits()){
+                    mptIDs.push_back(getID(Globals.values[glob]));
+                }
+            }
+            numGlobals = values.size();
+
+            // the other MPT values only matter if the function names them (its own values, or constants it uses)
+            if(storesThroughPointer){
+                for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I){
+                    if(MPTValues.count(&*I)){
+                        mptIDs.push_back(getID(&*I));
+                    }
+                    for (Use& operand : I->operands()){
+                        if(MPTValues.count(operand)){
+                            mptIDs.push_back(getID(operand));
+                        }
+                    }
+                }
+            }
+        }
+
+        unsigned getID(Value * val){
+            auto it = ids.find(val);
+            if(it != ids.end()){
+                return it->second;
+            }
+            ids[val] = values.size();
+            values.push_back(val);
+            return values.size() - 1;
+        }
+
+        // the entry holding the state of a global
+        unsigned getGlobalID(GlobalVariable * glob) const{
+            auto it = ids.find(glob);
+            return it == ids.end() ? 0 : it->second;
+        }
+    } Numbering;
+
     class ConstPropInfo : public Info {
         public:
             /*  Lattice
                 For this analysis, you will map every global variable to a single constant value, top (not constant), or bottom (all constants). 
                 using a lattice of height 2 for every variable guarantees termination in the worklist algorithm.
+
+                Absent marks a value the info holds no entry for; it reads as Bottom.
             */
-            enum ConstState{Bottom, Const, Top};    // enum to store which state the operand belongs to
-            
-            struct Const {  
-                ConstState state;
-                Constant* value; 
-                bool operator == (const Const& other) const{
-                    return state == other.state && value == other.value;
-                }
-            };
+            enum ConstState : uint8_t {Absent, Bottom, Const, Top};    // 2-bit tag of every tracked value
 
-            std::map<Value*, struct Const> constMap;   // the map used by ConstPropInfo to store the consts
+            // indexed by the ID of the value in Numbering; IDs past the end are Absent
+            vector<uint8_t> tags;
+            vector<Constant*> consts;       // the constant of the Const entries, nullptr otherwise
+
+            // SCCP mode: the edge can be taken. Non-executable edges only ever carry bottom.
+            bool executable = false;
 
             // ##############################################################
-            // helper fucntion to access constMap
+            // helper fucntion to access the lattice
             // ##############################################################
             Constant* getConst(Value* val){
-                if(constMap.find(val) != constMap.end()){
-                    return constMap[val].value; 
+                unsigned id = Numbering.getID(val);
+                if(id < tags.size() && tags[id] != Absent){
+                    return consts[id]; 
+                }
+                if(!SoundFacts() && !Solving){
+                    errs()<< *val <<"Not found "<<"\n";
                 }
-                errs()<< *val <<"Not found "<<"\n";
                 return nullptr;
             }
 
+            // the state of val, Absent if the info holds no entry for it (never inserts, never prints)
+            ConstState getState(Value* val){
+                auto it = Numbering.ids.find(val);
+                if(it == Numbering.ids.end() || it->second >= tags.size()){
+                    return Absent;
+                }
+                return (ConstState)tags[it->second];
+            }
+
+            // the constant val is known to hold, nullptr if it is not a Const entry (never inserts, never prints)
+            Constant* getFact(Value* val){
+                auto it = Numbering.ids.find(val);
+                if(it == Numbering.ids.end() || it->second >= tags.size() || tags[it->second] != Const){
+                    return nullptr;
+                }
+                return consts[it->second];
+            }
+
             void setConst(Value * val, Constant * c){
-                constMap[val].state = Const;
-                constMap[val].value = c;
+                set(Numbering.getID(val), Const, c);
             }
 
             void setTop(Value * val){
-                constMap[val].state = Top;
-                constMap[val].value = nullptr;
+                set(Numbering.getID(val), Top, nullptr);
             }
 
             void setBottom(Value * val){
-                constMap[val].state = Bottom;
-                constMap[val].value = nullptr;
+                set(Numbering.getID(val), Bottom, nullptr);
+            }
+
+            void setTop(unsigned id){
+                set(id, Top, nullptr);
             }
 
             void copy(Value * src, Value * dst){    
-                // copy is very important, need to handle the case where dst is in the constMap or not!!!
-                if(constMap.find(dst) != constMap.end()){
-                    constMap[dst] = constMap[src];       //Debug fixed
+                // a missing src is read as bottom, and stays in the info as bottom
+                unsigned from = Numbering.getID(src);
+                unsigned to = Numbering.getID(dst);
+                grow(std::max(from, to) + 1);
+                if(tags[from] == Absent){
+                    tags[from] = Bottom;
                 }
-                else{
-                    constMap.insert( std::pair<Value*, struct Const>(dst, constMap[src])); 
+                tags[to] = tags[from];
+                consts[to] = consts[from];
+            }
+
+            // add the entries of other that this info does not hold yet
+            void insert(const ConstPropInfo & other){
+                executable = executable || other.executable;
+                unsigned n = other.tags.size();
+                grow(n);
+                uint8_t * t = tags.data();
+                Constant ** c = consts.data();
+                const uint8_t * to = other.tags.data();
+                Constant * const * co = other.consts.data();
+                for(unsigned i = 0; i < n; i++){
+                    bool take = t[i] == Absent;
+                    t[i] = take ? to[i] : t[i];
+                    c[i] = take ? co[i] : c[i];
                 }
             }
             
             ConstPropInfo(): Info() { }
 
             ConstPropInfo(const ConstPropInfo& other): Info(other) {
-                constMap = other.constMap;
+                tags = other.tags;
+                consts = other.consts;
+                executable = other.executable;
             }
 
             ~ConstPropInfo() {}
 
+            // the state of every global of the module
+            void setGlobals(ConstState state){
+                for(unsigned id = 0; id < Numbering.numGlobals; id++){
+                    set(id, state, nullptr);
+                }
+            }
+
             void print() {
-                for (auto keyval : constMap){
-                    Value* val = keyval.first;
-                    ConstState state = keyval.second.state;
-                    Constant* const_value = keyval.second.value;
-
-                    GlobalVariable* globalVar = dyn_cast<GlobalVariable>(val);
-                    if(globalVar){
-                        if(state == Const){
-                            errs()<< globalVar->getName().str() << '=' << *const_value << '|';
-                        }
-                        if(state == Bottom){
-                            errs()<< globalVar->getName().str() << "=⊥|";
-                        }
-                        if(state == Top){
-                            errs()<< globalVar->getName().str() << "=⊤|";
-                        }
+                for (GlobalVariable* globalVar : Numbering.printOrder){
+                    unsigned id = Numbering.getGlobalID(globalVar);
+                    if(id >= tags.size()){
+                        continue;
+                    }
+                    if(tags[id] == Const){
+                        errs()<< globalVar->getName().str() << '=' << *consts[id] << '|';
+                    }
+                    if(tags[id] == Bottom){
+                        errs()<< globalVar->getName().str() << "=⊥|";
+                    }
+                    if(tags[id] == Top){
+                        errs()<< globalVar->getName().str() << "=⊤|";
                     }
                 }
                 errs()<<"\n";
             }
 
             static bool equals(ConstPropInfo * info1, ConstPropInfo * info2) {
-                return info1->constMap == info2->constMap;
+                if(info1->executable != info2->executable){
+                    return false;
+                }
+                ConstPropInfo * shorter = info1->tags.size() <= info2->tags.size() ? info1 : info2;
+                ConstPropInfo * longer = shorter == info1 ? info2 : info1;
+                unsigned n = shorter->tags.size();
+
+                const uint8_t * t1 = shorter->tags.data();
+                const uint8_t * t2 = longer->tags.data();
+                Constant * const * c1 = shorter->consts.data();
+                Constant * const * c2 = longer->consts.data();
+                bool differ = false;
+                for(unsigned i = 0; i < n; i++){
+                    differ |= (t1[i] != t2[i]) | (c1[i] != c2[i]);
+                }
+                for(unsigned i = n; i < longer->tags.size(); i++){
+                    differ |= t2[i] != Absent;
+                }
+                return !differ;
             }
 
+            /*
+                For every value present in info2, result = info1 ⊔ info2, where an absent entry of info1 reads as
+                (and is left in info1 as) bottom. Entries absent from info2 keep the value result already has.
+                Written as one branch-free pass over the tag and constant columns; result may be info1.
+            */
             static void join(ConstPropInfo * info1, ConstPropInfo * info2, ConstPropInfo * result){
- 
-                // info1 is for aggregating the result, traverse info2 (incoming Info) to update result !!!
-                for( auto keyval : info2->constMap){            //Debug fixed
-                    Value* val = keyval.first;
-                    //consider condition for state being top or constant in info1 or info2
-                    if ( info1->constMap[val].state == Top || info2->constMap[val].state == Top ){ 
-                        result->setTop(val);
-                    }
-                    else if( info1->constMap[val].value && info2->constMap[val].value && info1->constMap[val].value != info2->constMap[val].value){
-                        result->setTop(val);
-                    }
-                    else if( info1->constMap[val].state == Const) {
-                        result->setConst(val, info1->constMap[val].value);
-                    }
-                    else if( info2->constMap[val].state == Const) {
-                        result->setConst(val, info2->constMap[val].value);
-                    }
-                    else{
-                        //if state in both infos is neither top nor constant
-                        result->setBottom(val);
-                    }
+                unsigned n = info2->tags.size();
+                info1->grow(n);
+                result->grow(n);
+
+                uint8_t * t1 = info1->tags.data();
+                Constant ** c1 = info1->consts.data();
+                const uint8_t * t2 = info2->tags.data();
+                Constant * const * c2 = info2->consts.data();
+                uint8_t * tr = result->tags.data();
+                Constant ** cr = result->consts.data();
+                result->executable = info1->executable || info2->executable;
+
+                for(unsigned i = 0; i < n; i++){
+                    uint8_t a = t1[i] == Absent ? (uint8_t)Bottom : t1[i];
+                    uint8_t b = t2[i];
+                    bool present = b != Absent;
+                    bool top = a == Top || b == Top || (a == Const && b == Const && c1[i] != c2[i]);
+                    uint8_t tag = top ? (uint8_t)Top : (a == Const || b == Const) ? (uint8_t)Const : (uint8_t)Bottom;
+                    Constant * c = top ? nullptr : a == Const ? c1[i] : b == Const ? c2[i] : nullptr;
+
+                    t1[i] = present ? a : t1[i];
+                    tr[i] = present ? tag : tr[i];
+                    cr[i] = present ? c : cr[i];
                 }
             } 
+
+        private:
+            void grow(unsigned size){
+                if(tags.size() < size){
+                    tags.resize(size, Absent);
+                    consts.resize(size, nullptr);
+                }
+            }
+
+            void set(unsigned id, ConstState state, Constant * c){
+                grow(id + 1);
+                tags[id] = state;
+                consts[id] = c;
+            }
+    };
+
+    /*
+        Interprocedural facts: the constant every call site passes for an argument, the constant every return
+        of a function gives back. Both start at bottom (no call site, no return seen yet) and only go up, so the
+        functions are analyzed again until none of them changes.
+            ArgFacts      internal functions only called directly, by CallInsts with all their arguments
+            ReturnFacts   functions whose definition is the one that runs (hasExactDefinition)
+    */
+    struct ConstFact {
+        ConstPropInfo::ConstState state = ConstPropInfo::Bottom;
+        Constant* value = nullptr;
+
+        // join a state seen at a call site or a return; Absent (untracked) is top. Returns true if it changed.
+        bool join(ConstPropInfo::ConstState other, Constant* c){
+            if(other == ConstPropInfo::Bottom || state == ConstPropInfo::Top){
+                return false;
+            }
+            if(other == ConstPropInfo::Const && state == ConstPropInfo::Bottom){
+                state = ConstPropInfo::Const;
+                value = c;
+                return true;
+            }
+            if(other == ConstPropInfo::Const && value == c){
+                return false;
+            }
+            state = ConstPropInfo::Top;
+            value = nullptr;
+            return true;
+        }
     };
 
+    std::map<Function*, vector<ConstFact>> ArgFacts;
+    std::map<Function*, ConstFact> ReturnFacts;
+
+    bool calledOnlyDirectly(Function & F){
+        if(!F.hasLocalLinkage() || F.isVarArg()){
+            return false;
+        }
+        for(User* user : F.users()){
+            CallInst* call = dyn_cast<CallInst>(user);
+            if(!call || call->getCalledFunction() != &F || call->arg_size() != F.arg_size()){
+                return false;
+            }
+        }
+        return true;
+    }
+
     /*
         class ConstPropAnalysis performs const propagation analysis. 
         It should be a subclass of DataFlowAnalysis. 
@@ -182,12 +540,35 @@ namespace {
 
         ~ConstPropAnalysis() {}
 
+    private:
+        ConstantFolder FOLDER;
+
+        /*
+            The worklist revisits an instruction until its loop converges, most of the times on the same constant
+            operands. Folds are cached by (instruction, operand constants): constants are uniqued, so the pointers
+            are the key, and a revisit costs a hash lookup instead of a fold.
+        */
+        typedef pair<Instruction*, pair<Constant*, pair<Constant*, Constant*>>> FoldKey;
+        DenseMap<FoldKey, Constant*> foldCache;
+
+        template <typename Fold>
+        Constant* fold(Instruction* I, Constant* a, Constant* b, Constant* c, Fold doFold){
+            FoldLookups++;
+            auto inserted = foldCache.insert(make_pair(FoldKey(I, make_pair(a, make_pair(b, c))), nullptr));
+            if(!inserted.second){
+                FoldHits++;
+                return inserted.first->second;
+            }
+            inserted.first->second = doFold();
+            return inserted.first->second;
+        }
+
+    public:
         void flowfunction(  Instruction * I, 
                             vector<unsigned> & IncomingEdges,
                             vector<unsigned> & OutgoingEdges, 
                             vector<Info *> & Infos){
             
-            ConstantFolder FOLDER;
             auto *result = new ConstPropInfo();
             unsigned index = this->getIndexFromInstr(I);
             // string opName(I->getOpcodeName());
@@ -202,6 +583,15 @@ namespace {
                 Info::join(result, this->getInfoFromEdge(edge), result);  
             }
 
+            // SCCP: an instruction no executable edge reaches has no effect, bottom flows through
+            if (SCCP && !result->executable){
+                for(unsigned i=0; i<OutgoingEdges.size(); i++){
+                    Infos[i]->insert(*result); 
+                }
+                delete result;
+                return;
+            }
+
             // ##################################################
             // Step 2: identify the opcode name 
             // Ref  Inst:   https://llvm.org/doxygen/classllvm_1_1Instruction.html
@@ -233,7 +623,9 @@ namespace {
                 // Const analysis is a Must Analysis, 
                 // only if both x and y are const, we can say a is const
                 if(const_x && const_y){
-                    result->setConst(I, FOLDER.CreateBinOp(bin_op->getOpcode(), const_y, const_x)); 
+                    result->setConst(I, fold(I, const_x, const_y, nullptr, [&]{
+                        return FOLDER.CreateBinOp(bin_op->getOpcode(), const_x, const_y);
+                    }));
                 }
                 else{
                     result->setTop(I);
@@ -251,7 +643,9 @@ namespace {
                     const_x = result->getConst(x);
                 }
                 if(const_x){
-                    result->setConst(I, FOLDER.CreateUnOp(unary_op->getOpcode(), const_x)); 
+                    result->setConst(I, fold(I, const_x, nullptr, nullptr, [&]{
+                        return FOLDER.CreateUnOp(unary_op->getOpcode(), const_x);
+                    }));
                 }
                 else{
                     result->setTop(I);
@@ -261,7 +655,13 @@ namespace {
             //4. load  LoadInst -> Instruction
             if (LoadInst* load_inst = dyn_cast<LoadInst>(I)){
                 Value* val = load_inst->getPointerOperand();  
-                result->copy(val, I);
+                if (SoundFacts() && (!isa<GlobalVariable>(val) || load_inst->isVolatile())){
+                    // only the globals are tracked soundly
+                    result->setTop(I);
+                }
+                else{
+                    result->copy(val, I);
+                }
             }
 
             //5. store  StoreInst -> Instruction
@@ -271,12 +671,28 @@ namespace {
                 Value* val = store_inst->getValueOperand();                  
                 Value* ptr = store_inst->getPointerOperand();    
                 
-                if (LoadInst* load_inst = dyn_cast<LoadInst>(ptr)){
+                if (SoundFacts() && writesUnknownMemory(I)){
+                    result->setGlobals(ConstPropInfo::Top);
+                }
+                else if (SoundFacts()){
+                    // an untracked value stored is unknown, not bottom
+                    Constant* const_val = dyn_cast<Constant>(val);
+                    if (!const_val){
+                        const_val = result->getFact(val);
+                    }
+                    if (const_val){
+                        result->setConst(ptr, const_val);
+                    }
+                    else{
+                        result->setTop(ptr);
+                    }
+                }
+                else if (LoadInst* load_inst = dyn_cast<LoadInst>(ptr)){
                     //case1: *ptr = ...
                     // when we encounter an instruction which modifies a dereferenced pointer, set all variables in MPT to top.
                     // *var = ....  (load and store)        
-                    for(Value* mptVar : MPTSet){
-                        result->setTop(mptVar);
+                    for(unsigned id : Numbering.mptIDs){
+                        result->setTop(id);
                     }
                 }
                 else{
@@ -296,10 +712,27 @@ namespace {
             //  To simplify the analysis, after a call instruction we set all variables in the callee's MOD set to top 
             //  (we assume every variable in MOD was modified to some non constant value).
             if (CallInst* call_inst = dyn_cast<CallInst>(I)){
-                for(auto glob : MODMap[call_inst->getCalledFunction()]){
-                    result->setTop(glob);
+                for(unsigned glob : MODMap[call_inst->getCalledFunction()].set_bits()){
+                    result->setTop(Globals.values[glob]);
+                }
+
+                // the return value of a callee whose every return gives the same constant
+                if((Interprocedural || Specialize) && !I->getType()->isVoidTy()){
+                    auto returned = ReturnFacts.find(call_inst->getCalledFunction());
+                    if(returned == ReturnFacts.end() || returned->second.state == ConstPropInfo::Top){
+                        result->setTop(I);
+                    }
+                    else if(returned->second.state == ConstPropInfo::Const){
+                        result->setConst(I, returned->second.value);
+                    }
+                    else{
+                        result->setBottom(I);
+                    }
                 }
             }
+            if (SoundFacts() && !isa<StoreInst>(I) && writesUnknownMemory(I)){
+                result->setGlobals(ConstPropInfo::Top);
+            }
 
             //###############################################################
             //7. icmp -- int compare       ICmpInst -> CmpInst  ->  Instruction
@@ -322,7 +755,9 @@ namespace {
                     const_y = result->getConst(y);
                 }
                 if(const_x && const_y){
-                    result->setConst(I, FOLDER.CreateICmp (pred, const_x, const_y)); 
+                    result->setConst(I, fold(I, const_x, const_y, nullptr, [&]{
+                        return FOLDER.CreateICmp (pred, const_x, const_y);
+                    }));
                 }
                 else{
                     result->setTop(I);
@@ -347,7 +782,9 @@ namespace {
                     const_y = result->getConst(y);
                 }
                 if(const_x && const_y){
-                    result->setConst(I, FOLDER.CreateFCmp (pred, const_x, const_y)); 
+                    result->setConst(I, fold(I, const_x, const_y, nullptr, [&]{
+                        return FOLDER.CreateFCmp (pred, const_x, const_y);
+                    }));
                 }
                 else{
                     result->setTop(I);
@@ -359,21 +796,33 @@ namespace {
             // The ‘phi’ instruction is used to implement the φ node in the SSA graph representing the function.
             // <result> = phi [fast-math-flags] <ty> [ <val0>, <label0>], ...
             if (PHINode* phi_node = dyn_cast<PHINode>(I)){
-                
-                Value* val = phi_node->hasConstantValue();
-
-                if(val){
-                    Constant* const_val = dyn_cast<Constant>(val);
-                    if(!const_val){
-                        const_val = result->getConst(val);
-                    }
-                    if(const_val){
-                        result->setConst(I, const_val);
+                if (SCCP){
+                    // only the first phi of a block has edges in the DFA CFG: it evaluates the whole group
+                    if (phi_node == &*phi_node->getParent()->begin()){
+                        for (PHINode & phi : phi_node->getParent()->phis()){
+                            evaluatePhi(&phi, result);
+                        }
                     }
                 }
                 else{
-                    // Incoming values not all the same. return nullptr
-                    result->setTop(I);
+                    Value* val = phi_node->hasConstantValue();
+
+                    if(val){
+                        Constant* const_val = dyn_cast<Constant>(val);
+                        if(!const_val){
+                            const_val = result->getConst(val);
+                        }
+                        if(const_val){
+                            result->setConst(I, const_val);
+                        }
+                        else if(SoundFacts()){
+                            result->setTop(I);
+                        }
+                    }
+                    else{
+                        // Incoming values not all the same. return nullptr
+                        result->setTop(I);
+                    }
                 }
             }
 
@@ -405,7 +854,9 @@ namespace {
                 //      the predicate(condition), op1 and op2 are constants
                 //      op1 and op2 are equal and are constant (condition becomes irrelevant in this case)
                 if(cond_const && operand1_const && operand2_const){
-                    result->setConst(I, FOLDER.CreateSelect(cond_const, operand1_const, operand2_const)); 
+                    result->setConst(I, fold(I, cond_const, operand1_const, operand2_const, [&]{
+                        return FOLDER.CreateSelect(cond_const, operand1_const, operand2_const);
+                    }));
                 }
                 else if(operand1_const && operand2_const && operand1_const == operand2_const){
                     result->setConst(I, operand1_const); 
@@ -419,12 +870,71 @@ namespace {
             // Step 3: Add result to outgoing edges
             // ##################################################
             for(unsigned i=0; i<OutgoingEdges.size(); i++){
-                // Infos[i]->constMap = result->constMap;
-                Infos[i]->constMap.insert(result->constMap.begin(), result->constMap.end()); 
+                if (SCCP && !isFeasible(I, OutgoingEdges[i], result)){
+                    ConstPropInfo dead;
+                    dead.setGlobals(ConstPropInfo::Bottom);
+                    Infos[i]->insert(dead);
+                }
+                else{
+                    Infos[i]->insert(*result); 
+                }
             }
             
             delete result;
         }
+
+    private:
+        // SCCP: a branch or switch whose condition is a constant only takes one successor
+        bool isFeasible(Instruction * I, unsigned succIndex, ConstPropInfo * info){
+            BasicBlock* taken = nullptr;
+            if (BranchInst* br = dyn_cast<BranchInst>(I)){
+                if (br->isConditional()){
+                    if (ConstantInt* cond = dyn_cast_or_null<ConstantInt>(constantOf(br->getCondition(), info))){
+                        taken = br->getSuccessor(cond->isZero() ? 1 : 0);
+                    }
+                }
+            }
+            else if (SwitchInst* sw = dyn_cast<SwitchInst>(I)){
+                if (ConstantInt* cond = dyn_cast_or_null<ConstantInt>(constantOf(sw->getCondition(), info))){
+                    taken = sw->findCaseValue(cond)->getCaseSuccessor();
+                }
+            }
+            return !taken || this->getIndexFromInstr(&*taken->begin()) == succIndex;
+        }
+
+        /*
+            SCCP phi: only the incoming values of executable predecessor edges count.
+            Bottom while no incoming edge is executable, the constant if they all bring the same one, top otherwise.
+            The incoming value is read at the end of its predecessor.
+        */
+        void evaluatePhi(PHINode * phi_node, ConstPropInfo * result){
+            unsigned first = this->getIndexFromInstr(&*phi_node->getParent()->begin());
+            Constant* merged = nullptr;
+            for (unsigned k = 0; k < phi_node->getNumIncomingValues(); k++){
+                unsigned from = this->getIndexFromInstr(phi_node->getIncomingBlock(k)->getTerminator());
+                ConstPropInfo* edge = this->getInfoFromEdge(make_pair(from, first));
+                if (!edge->executable){
+                    continue;
+                }
+                Constant* c = constantOf(phi_node->getIncomingValue(k), edge);
+                if (!c || (merged && merged != c)){
+                    result->setTop(phi_node);
+                    return;
+                }
+                merged = c;
+            }
+            if (merged){
+                result->setConst(phi_node, merged);
+            }
+            else{
+                result->setBottom(phi_node);
+            }
+        }
+
+        static Constant* constantOf(Value * val, ConstPropInfo * info){
+            Constant* c = dyn_cast<Constant>(val);
+            return c ? c : info->getFact(val);
+        }
     };
 
  
@@ -448,6 +958,24 @@ namespace {
         bool doInitialization(CallGraph & CG) override {
             
             set<Function*> StarFuncSet;
+
+            Imported = ModSummary();
+            if (!ReadSummary.empty()){
+                string error;
+                if (!Imported.read(ReadSummary, error)){
+                    errs() << "cse231-constprop: cannot read the summary " << error << "\n";
+                }
+            }
+
+            Globals.initialize(CG.getModule());
+            MPTGlobals.clear();
+            MPTGlobals.resize(Globals.size());
+            MPTValues.clear();
+            MODMap.clear();
+            MODMap[nullptr].resize(Globals.size());
+            for(Function& F : CG.getModule().functions()){
+                MODMap[&F].resize(Globals.size());
+            }
             
             for(Function& F : CG.getModule().functions()){
                 
@@ -462,12 +990,12 @@ namespace {
                         Value* valueOperand = I->getOperand(0);       //Y
                         Value* pointerOperand = I->getOperand(1);     //X
 
-                        MPTSet.insert(valueOperand);    
+                        addToMPT(valueOperand);
 
                         // If an instruction modifies a global variable, the global variable must be added to LMOD, glob = ....
                         // Add glob to the LMOD set for that function
                         if (GlobalVariable* globalVar = dyn_cast<GlobalVariable>(pointerOperand)){   
-                            MODMap[&F].insert(globalVar);
+                            MODMap[&F].set(Globals.getID(globalVar));
                         }
 
                         // If an instruction modifies a dereferenced pointer in any given function F, 
@@ -482,22 +1010,124 @@ namespace {
                         for (Use& operand : I->operands()) {
                             // If you encounter an operand in a function that is being passed by reference, 
                             // you need to add it to the MPT set as well.  EX   function foo (....&operand....){
-                            MPTSet.insert(operand);
+                            addToMPT(operand);
+                        }
+                    }
+
+                    if (SoundFacts() && writesUnknownMemory(&*I)){
+                        MODMap[&F].set();
+                    }
+                }
+
+                const FunctionModSummary* summary = F.isDeclaration() ? Imported.get(F.getName()) : nullptr;
+                if (summary){
+                    // defined in another module: its MOD set is in the summary
+                    for (const string & name : summary->mod){
+                        if (GlobalVariable* globalVar = CG.getModule().getNamedGlobal(name)){
+                            MODMap[&F].set(Globals.getID(globalVar));
                         }
                     }
+                    if (summary->star){
+                        StarFuncSet.insert(&F);
+                    }
+                    if (SoundFacts() && summary->unknown){
+                        MODMap[&F].set();
+                    }
+                }
+                else if (SoundFacts() && F.isDeclaration() && !F.onlyReadsMemory()){
+                    MODMap[&F].set();
+                }
+            }
+
+            // the external globals whose address another module takes
+            for (const string & name : Imported.mpt){
+                if (GlobalVariable* globalVar = CG.getModule().getNamedGlobal(name)){
+                    addToMPT(globalVar);
                 }
             }
 
             for(Function* F : StarFuncSet){
                 // add the subset of MPT containing GlobalVariables to the LMOD for that particular function.
-                for (auto Val : MPTSet){
-                    if (GlobalVariable *globalVar = dyn_cast<GlobalVariable>(Val)){
-                        MODMap[F].insert(globalVar);
-                    }
+                MODMap[F] |= MPTGlobals;
+            }
+
+            computeCMOD(CG);
+
+            if (!WriteSummary.empty()){
+                string error;
+                if (!summarizeModule(CG, StarFuncSet).write(WriteSummary, error)){
+                    errs() << "cse231-constprop: cannot write the summary " << error << "\n";
                 }
             }
-            
             return false;
+        }
+
+        /*
+            The summary of the functions the module exports (see ModSummary.h). A function's entry covers the
+            defined functions it reaches in the module; the declarations it reaches that may write memory are
+            left as calls, for the merge to resolve. Only the external globals are named, the others cannot be
+            seen from another module.
+        */
+        ModSummary summarizeModule(CallGraph & CG, const set<Function*> & StarFuncSet){
+            Module & M = CG.getModule();
+            map<Function*, FunctionModSummary> local;
+            ModSummary summary;
+            for (GlobalVariable& glob : M.globals()){
+                if (!glob.hasLocalLinkage() && MPTGlobals.test(Globals.getID(&glob))){
+                    summary.mpt.insert(glob.getName().str());
+                }
+            }
+
+            for (Function& F : M.functions()){
+                if (F.isDeclaration()){
+                    continue;
+                }
+                FunctionModSummary & entry = local[&F];
+                entry.star = StarFuncSet.count(&F) != 0;
+                for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I){
+                    StoreInst* store_inst = dyn_cast<StoreInst>(&*I);
+                    GlobalVariable* globalVar = store_inst ? dyn_cast<GlobalVariable>(store_inst->getPointerOperand()) : nullptr;
+                    if (globalVar && !globalVar->hasLocalLinkage()){
+                        entry.mod.insert(globalVar->getName().str());
+                    }
+
+                    CallInst* call_inst = dyn_cast<CallInst>(&*I);
+                    Function* callee = call_inst ? call_inst->getCalledFunction() : nullptr;
+                    if (callee && callee->isDeclaration()){
+                        if (!callee->onlyReadsMemory()){
+                            entry.calls.insert(callee->getName().str());
+                        }
+                    }
+                    else if (writesUnknownMemory(&*I)){
+                        entry.unknown = true;
+                    }
+                }
+            }
+
+            for (Function& F : M.functions()){
+                if (F.isDeclaration() || F.hasLocalLinkage()){
+                    continue;
+                }
+                // everything F reaches through defined functions of the module
+                FunctionModSummary & entry = summary.functions[F.getName().str()];
+                set<Function*> visited;
+                vector<Function*> stack(1, &F);
+                while (!stack.empty()){
+                    Function* caller = stack.back();
+                    stack.pop_back();
+                    if (!visited.insert(caller).second){
+                        continue;
+                    }
+                    entry.merge(local[caller]);
+                    for (auto const & record : *CG[caller]){
+                        Function* callee = record.second->getFunction();
+                        if (callee && !callee->isDeclaration()){
+                            stack.push_back(callee);
+                        }
+                    }
+                }
+            }
+            return summary;
         }	
         
         //1.2  build your CMOD data structures 
@@ -506,61 +1136,102 @@ namespace {
 
             The SCC will give you all the caller-callee relationship that you can use to calculate the MOD for the functions in your module. 
             You'll get the LMOD[caller] and then you'll get the MOD[callee] . The union of these two things is MOD[caller]
+            All the functions of an SCC share the same MOD set.
 
-            !!! CallGraphSCCPass does a bottom-up traversal on the CallGraph, 
-            i.e., it starts from the leaf nodes.
-            The callee info would have been calculated before we go to the caller
+            Rather than one runOnSCC call per SCC, the SCCs of the condensed call graph are grouped by level
+            (1 + the highest level of their callees' SCCs, 0 for the leaves). The SCCs of a level only read the MOD
+            sets of lower levels and only write their own, so -cse231-constprop-threads workers can process them
+            in parallel; the levels themselves are processed bottom-up.
 
             Ref: https://llvm.org/doxygen/classllvm_1_1CallGraphNode.html#a5235ef73c96bae36f342bb61e9b02071
                  https://llvm.org/doxygen/CallGraph_8h_source.html#l00187
         */
+        void computeCMOD(CallGraph & CG){
+            vector<vector<Function*>> sccs;         // the functions of every SCC
+            vector<vector<Function*>> callees;      // the functions they call, outside and inside the SCC
+            vector<unsigned> levels;
+            DenseMap<Function*, unsigned> sccOf;
+            unsigned maxLevel = 0;
+
+            for (scc_iterator<CallGraph*> it = scc_begin(&CG); !it.isAtEnd(); ++it){
+                vector<Function*> scc, called;
+                unsigned id = sccs.size();
+                unsigned level = 0;
+                for(CallGraphNode* caller_node : *it){
+                    Function* caller_F = caller_node->getFunction();
+                    if(!caller_F){
+                        continue;
+                    }
+                    scc.push_back(caller_F);
+                    for (auto callrecord : (*caller_node)){
+                        Function* callee_F = callrecord.second->getFunction();
+                        if(!callee_F){
+                            continue;
+                        }
+                        called.push_back(callee_F);
+                        auto callee_scc = sccOf.find(callee_F);
+                        if(callee_scc != sccOf.end()){
+                            level = std::max(level, levels[callee_scc->second] + 1);
+                        }
+                    }
+                }
+                if(scc.empty()){
+                    continue;
+                }
+                for(Function* F : scc){
+                    sccOf[F] = id;
+                }
+                sccs.push_back(scc);
+                callees.push_back(called);
+                levels.push_back(level);
+                maxLevel = std::max(maxLevel, level);
+            }
+
+            vector<vector<unsigned>> byLevel(maxLevel + 1);
+            for(unsigned id = 0; id < sccs.size(); id++){
+                byLevel[levels[id]].push_back(id);
+            }
+
+            // every MOD set already exists, so the map is only read concurrently
+            auto computeSCC = [&](unsigned id){
+                BitVector currSCCModSet(Globals.size());
+                for(Function* F : sccs[id]){
+                    currSCCModSet |= MODMap.find(F)->second;
+                }
+                for(Function* callee_F : callees[id]){
+                    currSCCModSet |= MODMap.find(callee_F)->second;
+                }
+                for(Function* F : sccs[id]){
+                    MODMap.find(F)->second = currSCCModSet;
+                }
+            };
+
+            for(auto const & level : byLevel){
+                unsigned workers = std::min<unsigned>(std::max<unsigned>(ModThreads, 1), level.size());
+                if(workers <= 1){
+                    for(unsigned id : level){
+                        computeSCC(id);
+                    }
+                    continue;
+                }
+
+                atomic<unsigned> next(0);
+                vector<thread> pool;
+                for(unsigned w = 0; w < workers; w++){
+                    pool.push_back(thread([&](){
+                        for(unsigned i = next++; i < level.size(); i = next++){
+                            computeSCC(level[i]);
+                        }
+                    }));
+                }
+                for(thread & t : pool){
+                    t.join();
+                }
+            }
+        }
+
+        // CMOD is computed for the whole call graph by computeCMOD, at the end of doInitialization
         bool runOnSCC(CallGraphSCC &SCC) override{
-           
-            set<GlobalVariable*> currSCCModSet; // all graphNode has the same MOD set
-
-            //Get CallGraphNode *caller_node from SCC
-            for(CallGraphNode* caller_node : SCC){
-
-                //Get Function* caller from the caller_node (using getFunction())
-                Function* caller_F = caller_node->getFunction();
-
-                // Get CallGraphNode *callee_node from the *caller_node
-                for (auto callrecord : (*caller_node)){
-                    // Get Function* callee from the callee_node (using getFunction())
-                    Function* callee_F = callrecord.second->getFunction();
-
-                    // Union Callee’s MOD with the Caller’s MOD (set of GlobalVariable*)
-                    if(callee_F && caller_F){
-                       MODMap[caller_F].insert(MODMap[callee_F].begin(), MODMap[callee_F].end());
-                    }  
-                }
-                // add MODMap[caller_F] into currSCCModSet
-                currSCCModSet.insert(MODMap[caller_F].begin(), MODMap[caller_F].end());                    
-            }
-
-            // update MOD of all F in the SCC            
-            for(CallGraphNode* caller_node : SCC){
-                Function* caller_F = caller_node->getFunction();
-                MODMap[caller_F] = currSCCModSet;
-            }
-
-            //##################################################
-            // debug 
-            //##################################################
-            // errs()<< "############### SCC ###################\n";
-            // errs()<< "MPTSet";
-            // for (Value* val : MPTSet){
-            //     errs()<< *val << "\n";
-            // }
-            // errs()<< "\nMODMap";
-            // for (auto entry : MODMap){
-            //     errs()<< entry.first << "==> ";
-            //     for (GlobalVariable* gb : entry.second){
-            //         errs()<< *gb << "   ";
-            //     } 
-            //     errs()<< "\n";
-            // }
-            //##################################################   
             return false;
         }
 
@@ -570,21 +1241,500 @@ namespace {
         //  The analysis describes at each point in the program which global variables must be a constant value, and their corresponding constant values
         bool doFinalization(CallGraph &CG) override {
             
+            Numbering.initialize(CG.getModule());
+            FoldLookups = FoldHits = 0;
+            if(Interprocedural || Specialize){
+                solveInterprocedural(CG.getModule());
+            }
+            if(Transform && Specialize){
+                specialize(CG);
+            }
+
             for(Function& F : CG.getModule().functions()){
+                if(F.isDeclaration()){
+                    continue;   // no body: nothing to analyze, print, rewrite or annotate
+                }
+                Numbering.beginFunction(F);
                 ConstPropInfo top, bot;
                 // set all global to top
-                for(GlobalVariable& glob : CG.getModule().getGlobalList()){
-                    top.setTop(&glob);
-                }
-                for(GlobalVariable& glob : CG.getModule().getGlobalList()){
-                    bot.setBottom(&glob);
-                }
+                top.setGlobals(ConstPropInfo::Top);
+                top.executable = SCCP;      // only the entry is executable to begin with
+                seedArguments(F, top);
+                bot.setGlobals(ConstPropInfo::Bottom);
                 ConstPropAnalysis<ConstPropInfo,true> cpa(bot, top);    //buttom, initStte
                 cpa.runWorklistAlgorithm(&F);
-                cpa.print();                    
+                if(Annotate){
+                    annotate(F, cpa);
+                }
+                if(Transform){
+                    rewrite(F, cpa);
+                }
+                else if(!Annotate){
+                    cpa.print();                    
+                }
             }
-            
-            return false;
+
+            bool changed = false;
+            if(Annotate){
+                annotateMOD(CG.getModule());
+            }
+            if(InferAttrs){
+                changed |= inferFunctionAttributes(CG.getModule());
+                changed |= inferConstantGlobals(CG.getModule());
+            }
+            if(FoldStats){
+                errs() << "fold cache: " << FoldLookups << " lookups, " << FoldHits << " hits";
+                if(FoldLookups){
+                    errs() << format(" (%.1f%%)", 100.0 * FoldHits / FoldLookups);
+                }
+                errs() << "\n";
+            }
+            return Transform || Annotate || changed;
+        }
+
+        /*
+            Function attributes from the MOD sets. A function is
+                readonly   if its MOD set is empty, none of its instructions writes memory the MOD sets do not name
+                           (writesUnknownMemory, volatile or atomic accesses), and its callees are readonly;
+                nosync     if it has no atomic instruction, fence or volatile access, and its callees are nosync.
+            Recursive functions are handled by starting from every function that passes the local checks and
+            removing those that call a function which is not in the set, until none is removed.
+            Only the functions whose definition is the one that runs (hasExactDefinition) get attributes.
+        */
+        bool inferFunctionAttributes(Module &M){
+            set<Function*> readOnly, noSync;
+            map<Function*, vector<Function*>> callees;      // the defined functions each candidate calls
+            for(Function& F : M.functions()){
+                if(F.isDeclaration() || !F.hasExactDefinition()){
+                    continue;
+                }
+                bool reads = MODMap[&F].none();
+                bool sync = false;
+                for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I){
+                    bool isVolatile = (isa<LoadInst>(&*I) && cast<LoadInst>(&*I)->isVolatile()) ||
+                                      (isa<StoreInst>(&*I) && cast<StoreInst>(&*I)->isVolatile());
+                    if(writesUnknownMemory(&*I) || isVolatile || I->isAtomic()){
+                        reads = false;
+                    }
+                    if(isVolatile || I->isAtomic()){
+                        sync = true;
+                    }
+                    if(CallBase* call = dyn_cast<CallBase>(&*I)){
+                        Function* callee = call->getCalledFunction();
+                        if(!callee || call->isInlineAsm()){
+                            reads = false;
+                            sync = true;
+                        }
+                        else if(callee->isDeclaration()){
+                            sync |= !callee->hasFnAttribute(Attribute::NoSync);
+                        }
+                        else{
+                            callees[&F].push_back(callee);
+                        }
+                    }
+                }
+                if(reads){
+                    readOnly.insert(&F);
+                }
+                if(!sync){
+                    noSync.insert(&F);
+                }
+            }
+
+            auto closeOverCalls = [&](set<Function*> &candidates){
+                bool removed = true;
+                while(removed){
+                    removed = false;
+                    for(auto it = candidates.begin(); it != candidates.end(); ){
+                        bool keep = true;
+                        for(Function* callee : callees[*it]){
+                            keep &= candidates.count(callee) != 0;
+                        }
+                        if(keep){
+                            ++it;
+                        }
+                        else{
+                            it = candidates.erase(it);
+                            removed = true;
+                        }
+                    }
+                }
+            };
+            closeOverCalls(readOnly);
+            closeOverCalls(noSync);
+
+            bool changed = false;
+            for(Function* F : readOnly){
+                if(!F->onlyReadsMemory()){
+                    F->addFnAttr(Attribute::ReadOnly);
+                    changed = true;
+                }
+            }
+            for(Function* F : noSync){
+                if(!F->hasFnAttribute(Attribute::NoSync)){
+                    F->addFnAttr(Attribute::NoSync);
+                    changed = true;
+                }
+            }
+            return changed;
+        }
+
+        /*
+            An internal global with an initializer is constant if no MOD set contains it, it is not in MPT (its
+            address is never stored, passed or returned), and it is only ever used directly as the address of a load
+            or a store, so that no write can reach it without the MOD sets seeing it.
+        */
+        bool inferConstantGlobals(Module &M){
+            BitVector modified(Globals.size());
+            for(Function& F : M.functions()){
+                if(!F.isDeclaration()){
+                    modified |= MODMap[&F];
+                }
+            }
+
+            bool changed = false;
+            for(GlobalVariable& glob : M.globals()){
+                if(glob.isConstant() || !glob.hasLocalLinkage() || !glob.hasDefinitiveInitializer() || glob.isThreadLocal()){
+                    continue;
+                }
+                unsigned id = Globals.getID(&glob);
+                if(modified.test(id) || MPTGlobals.test(id)){
+                    continue;
+                }
+                bool direct = true;
+                for(User* user : glob.users()){
+                    LoadInst* load = dyn_cast<LoadInst>(user);
+                    StoreInst* store = dyn_cast<StoreInst>(user);
+                    direct &= (load && !load->isVolatile()) || (store && store->getPointerOperand() == &glob);
+                }
+                if(direct){
+                    glob.setConstant(true);
+                    changed = true;
+                }
+            }
+            return changed;
+        }
+
+        // the constant arguments of F in the initial state of its analysis
+        void seedArguments(Function &F, ConstPropInfo &top){
+            auto facts = ArgFacts.find(&F);
+            if(!(Interprocedural || Specialize)){
+                return;
+            }
+            for(Argument& arg : F.args()){
+                if(facts == ArgFacts.end() || facts->second[arg.getArgNo()].state == ConstPropInfo::Top){
+                    top.setTop(&arg);
+                }
+                else if(facts->second[arg.getArgNo()].state == ConstPropInfo::Const){
+                    top.setConst(&arg, facts->second[arg.getArgNo()].value);
+                }
+            }
+        }
+
+        /*
+            The fact of val from the infos of some edges: a constant operand is itself, otherwise the join of its
+            states on the edges.
+        */
+        static ConstFact factOf(Value* val, const vector<ConstPropInfo*> &infos){
+            ConstFact fact;
+            if(Constant* c = dyn_cast<Constant>(val)){
+                fact.join(ConstPropInfo::Const, c);
+                return fact;
+            }
+            for(ConstPropInfo* info : infos){
+                fact.join(info->getState(val), info->getFact(val));
+            }
+            return fact;
+        }
+
+        /*
+            Analyze every function with the current ArgFacts and ReturnFacts, join what its call sites pass and
+            what its returns give back, until nothing changes. The call sites of the last round, with the
+            constants they pass, are kept for specialize().
+        */
+        vector<pair<CallInst*, vector<Constant*>>> CallSites;
+
+        void solveInterprocedural(Module &M){
+            ArgFacts.clear();
+            ReturnFacts.clear();
+            for(Function& F : M.functions()){
+                if(F.isDeclaration()){
+                    continue;
+                }
+                if(calledOnlyDirectly(F)){
+                    ArgFacts[&F].resize(F.arg_size());
+                }
+                if(F.hasExactDefinition()){
+                    ReturnFacts[&F];
+                }
+            }
+
+            Solving = true;
+            bool changed = true;
+            while(changed){
+                changed = false;
+                CallSites.clear();
+                for(Function& F : M.functions()){
+                    if(F.isDeclaration()){
+                        continue;
+                    }
+                    Numbering.beginFunction(F);
+                    ConstPropInfo top, bot;
+                    top.setGlobals(ConstPropInfo::Top);
+                    top.executable = SCCP;
+                    seedArguments(F, top);
+                    bot.setGlobals(ConstPropInfo::Bottom);
+                    ConstPropAnalysis<ConstPropInfo,true> cpa(bot, top);
+                    cpa.runWorklistAlgorithm(&F);
+
+                    map<unsigned, vector<ConstPropInfo*>> before, after;
+                    for(auto const & edge : cpa.getEdgeToInfo()){
+                        before[edge.first.second].push_back(edge.second);
+                        after[edge.first.first].push_back(edge.second);
+                    }
+
+                    unsigned index = 1;
+                    for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I, ++index){
+                        if(CallInst* call = dyn_cast<CallInst>(&*I)){
+                            vector<Constant*> passed;
+                            auto facts = ArgFacts.find(call->getCalledFunction());
+                            for(unsigned k = 0; k < call->arg_size(); k++){
+                                ConstFact fact = factOf(call->getArgOperand(k), after[index]);
+                                passed.push_back(fact.state == ConstPropInfo::Const ? fact.value : nullptr);
+                                if(facts != ArgFacts.end()){
+                                    changed |= facts->second[k].join(fact.state, fact.value);
+                                }
+                            }
+                            CallSites.push_back(make_pair(call, passed));
+                        }
+                        ReturnInst* ret = dyn_cast<ReturnInst>(&*I);
+                        if(ret && ret->getReturnValue() && ReturnFacts.count(&F)){
+                            ConstFact fact = factOf(ret->getReturnValue(), before[index]);
+                            changed |= ReturnFacts[&F].join(fact.state, fact.value);
+                        }
+                    }
+                }
+            }
+            Solving = false;
+        }
+
+        /*
+            Function specialization (transform mode): the call sites passing the same constants to the same callee,
+            for arguments that are not already constant for every call site, are grouped; the groups of at least
+            -cse231-constprop-specialize-min-calls sites, largest first, get an internal clone of the callee with
+            those arguments replaced by the constants, as long as the clones fit in -cse231-constprop-specialize-budget
+            instructions. The clones are then analyzed and rewritten like the other functions.
+        */
+        void specialize(CallGraph &CG){
+            map<pair<Function*, vector<Constant*>>, vector<CallInst*>> groups;
+            for(auto const & site : CallSites){
+                CallInst* call = site.first;
+                Function* callee = call->getCalledFunction();
+                if(!callee || callee->isDeclaration() || callee->isVarArg() || call->isMustTailCall() ||
+                   call->hasOperandBundles() || call->arg_size() != callee->arg_size()){
+                    continue;
+                }
+
+                auto facts = ArgFacts.find(callee);
+                vector<Constant*> tuple(site.second);
+                bool any = false;
+                for(unsigned k = 0; k < tuple.size(); k++){
+                    bool known = facts != ArgFacts.end() && facts->second[k].state == ConstPropInfo::Const;
+                    bool abi = callee->hasParamAttribute(k, Attribute::ByVal) || callee->hasParamAttribute(k, Attribute::InAlloca) ||
+                               callee->hasParamAttribute(k, Attribute::StructRet);
+                    if(known || abi){
+                        tuple[k] = nullptr;
+                    }
+                    any |= tuple[k] != nullptr;
+                }
+                if(any){
+                    groups[make_pair(callee, tuple)].push_back(call);
+                }
+            }
+
+            vector<pair<unsigned, pair<Function*, vector<Constant*>>>> candidates;
+            for(auto const & group : groups){
+                if(group.second.size() >= SpecializeMinCalls){
+                    candidates.push_back(make_pair((unsigned)group.second.size(), group.first));
+                }
+            }
+            std::stable_sort(candidates.begin(), candidates.end(), [](const pair<unsigned, pair<Function*, vector<Constant*>>> &a,
+                                                                     const pair<unsigned, pair<Function*, vector<Constant*>>> &b){
+                return a.first > b.first;
+            });
+
+            unsigned budget = SpecializeBudget;
+            for(auto const & candidate : candidates){
+                Function* callee = candidate.second.first;
+                const vector<Constant*> &tuple = candidate.second.second;
+                unsigned size = callee->getInstructionCount();
+                if(size > budget){
+                    continue;
+                }
+                budget -= size;
+
+                ValueToValueMapTy VMap;
+                for(unsigned k = 0; k < tuple.size(); k++){
+                    if(tuple[k]){
+                        VMap[&*(callee->arg_begin() + k)] = tuple[k];
+                    }
+                }
+                Function* clone = CloneFunction(callee, VMap);
+                clone->setLinkage(GlobalValue::InternalLinkage);
+                clone->setName(callee->getName() + ".spec");
+                MODMap[clone] = MODMap[callee];
+
+                CallGraphNode* cloneNode = CG.getOrInsertFunction(clone);
+                for (inst_iterator I = inst_begin(clone), E = inst_end(clone); I != E; ++I){
+                    if(CallBase* call = dyn_cast<CallBase>(&*I)){
+                        Function* called = call->getCalledFunction();
+                        if(!called){
+                            cloneNode->addCalledFunction(call, CG.getCallsExternalNode());
+                        }
+                        else if(!called->isIntrinsic()){
+                            cloneNode->addCalledFunction(call, CG.getOrInsertFunction(called));
+                        }
+                    }
+                }
+
+                for(CallInst* call : groups[candidate.second]){
+                    vector<Value*> args;
+                    for(unsigned k = 0; k < tuple.size(); k++){
+                        if(!tuple[k]){
+                            args.push_back(call->getArgOperand(k));
+                        }
+                    }
+                    CallInst* newCall = CallInst::Create(clone, args, "", call);
+                    newCall->setCallingConv(call->getCallingConv());
+                    newCall->setDebugLoc(call->getDebugLoc());
+                    newCall->takeName(call);
+                    // before the RAUW, which the call graph's value handles would follow
+                    CG[call->getFunction()]->replaceCallEdge(*call, *newCall, cloneNode);
+                    call->replaceAllUsesWith(newCall);
+                    call->eraseFromParent();
+                }
+            }
+        }
+
+        /*
+            Annotate mode: attach the converged facts of F to its instructions, so that later passes or tools read
+            them instead of running the analysis again. Metadata is kept in bitcode.
+                !cse231.const !{<ty> C}     the instruction always produces the constant C (integer, float, null)
+                !range !{<ty> C, <ty> C+1}  on integer loads and calls, for the passes that understand value ranges
+            The facts are read on the outgoing edges of the instruction, as in rewrite().
+        */
+        void annotate(Function &F, ConstPropAnalysis<ConstPropInfo,true> &cpa){
+            map<unsigned, ConstPropInfo*> after;
+            for(auto const & edge : cpa.getEdgeToInfo()){
+                after.insert(make_pair(edge.first.first, edge.second));
+            }
+
+            LLVMContext &Ctx = F.getContext();
+            unsigned constKind = Ctx.getMDKindID("cse231.const");
+            unsigned index = 1;
+            for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I, ++index){
+                if(I->getType()->isVoidTy() || after.count(index) == 0){
+                    continue;
+                }
+                Constant* c = after[index]->getFact(&*I);
+                if(!c || c->getType() != I->getType() ||
+                   !(isa<ConstantInt>(c) || isa<ConstantFP>(c) || isa<ConstantPointerNull>(c))){
+                    continue;
+                }
+                I->setMetadata(constKind, MDNode::get(Ctx, ConstantAsMetadata::get(c)));
+                ConstantInt* value = dyn_cast<ConstantInt>(c);
+                if(value && (isa<LoadInst>(&*I) || isa<CallInst>(&*I))){
+                    I->setMetadata(LLVMContext::MD_range, MDBuilder(Ctx).createRange(value->getValue(), value->getValue() + 1));
+                }
+            }
+        }
+
+        /*
+            Annotate mode: the MOD set of every defined function as the named metadata
+                !cse231.mod = !{!{<function>, <global>...}, ...}
+            and the globals of MPT as !cse231.mpt = !{!{<global>...}}.
+            Previous annotations are replaced.
+        */
+        void annotateMOD(Module &M){
+            LLVMContext &Ctx = M.getContext();
+            if(NamedMDNode* old = M.getNamedMetadata("cse231.mod")){
+                M.eraseNamedMetadata(old);
+            }
+            if(NamedMDNode* old = M.getNamedMetadata("cse231.mpt")){
+                M.eraseNamedMetadata(old);
+            }
+
+            NamedMDNode* mod = M.getOrInsertNamedMetadata("cse231.mod");
+            for(Function& F : M.functions()){
+                if(F.isDeclaration()){
+                    continue;
+                }
+                vector<Metadata*> entry(1, ConstantAsMetadata::get(&F));
+                for(unsigned glob : MODMap[&F].set_bits()){
+                    entry.push_back(ConstantAsMetadata::get(Globals.values[glob]));
+                }
+                mod->addOperand(MDNode::get(Ctx, entry));
+            }
+
+            vector<Metadata*> globals;
+            for(unsigned glob : MPTGlobals.set_bits()){
+                globals.push_back(ConstantAsMetadata::get(Globals.values[glob]));
+            }
+            M.getOrInsertNamedMetadata("cse231.mpt")->addOperand(MDNode::get(Ctx, globals));
+        }
+
+        /*
+            Transform mode: use the converged facts of F to
+                1   replace loads of globals and folded instructions that must be constant by the constant,
+                2   fold the branches and switches whose condition became constant,
+                3   delete the blocks that are no longer reachable.
+            The fact of an instruction is read on its outgoing edges, where the flow function has just set it;
+            an unreachable instruction only sees bottom and is left alone.
+            Calls deleted with their blocks leave null call records in the CallGraph, which the next
+            CallGraph refresh drops, as for calls deleted by a function pass.
+        */
+        void rewrite(Function &F, ConstPropAnalysis<ConstPropInfo,true> &cpa){
+            map<unsigned, ConstPropInfo*> after;
+            for(auto const & edge : cpa.getEdgeToInfo()){
+                after.insert(make_pair(edge.first.first, edge.second));
+            }
+
+            vector<pair<Instruction*, Constant*>> replacements;
+            unsigned index = 1;
+            for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I, ++index){
+                bool foldable = isa<BinaryOperator>(&*I) || isa<UnaryOperator>(&*I) || isa<CmpInst>(&*I) ||
+                                isa<SelectInst>(&*I) || isa<PHINode>(&*I) ||
+                                ((Interprocedural || Specialize) && isa<CallInst>(&*I)) ||
+                                (isa<LoadInst>(&*I) && isa<GlobalVariable>(cast<LoadInst>(&*I)->getPointerOperand()));
+                if(!foldable || after.count(index) == 0){
+                    continue;
+                }
+                Constant* c = after[index]->getFact(&*I);
+                // constant expressions (e.g. a division by zero) are not worth materializing
+                if(c && c->getType() == I->getType() &&
+                   (isa<ConstantInt>(c) || isa<ConstantFP>(c) || isa<ConstantPointerNull>(c))){
+                    replacements.push_back(make_pair(&*I, c));
+                }
+            }
+
+            for(auto const & replacement : replacements){
+                replacement.first->replaceAllUsesWith(replacement.second);
+            }
+            auto facts = ArgFacts.find(&F);
+            for(Argument& arg : F.args()){
+                if(facts != ArgFacts.end() && facts->second[arg.getArgNo()].state == ConstPropInfo::Const){
+                    arg.replaceAllUsesWith(facts->second[arg.getArgNo()].value);
+                }
+            }
+            for(auto const & replacement : replacements){
+                if(isInstructionTriviallyDead(replacement.first)){
+                    replacement.first->eraseFromParent();
+                }
+            }
+            for(BasicBlock & BB : F){
+                ConstantFoldTerminator(&BB, true);
+            }
+            removeUnreachableBlocks(F);
         }
     };
 }
@@ -0,0 +1,487 @@
+/*  Flow-insensitive May-point-to Analysis
+    The flow-sensitive MayPointToAnalysis keeps a whole pointerMap on every edge of the DFA CFG.
+    The solvers below ignore the order of the instructions and compute a single points-to map
+    for a function (or a whole module) from a set of inclusion constraints:
+
+        AddressOf   p ⊇ {o}      alloca, global
+        Copy        p ⊇ q        bitcast, getelementptr, select, phi, argument passing, return value
+        Load        p ⊇ *q       load
+        Store       *p ⊇ q       store
+
+    SteensgaardSolver  unifies both sides of every constraint with union-find (near-linear, less precise).
+    AndersenSolver     propagates along the inclusion graph and collapses cycles as it finds them (more precise).
+*/
+#ifndef LLVM_TRANSFORMS_FLOWINSENSITIVEPOINTSTO_H
+#define LLVM_TRANSFORMS_FLOWINSENSITIVEPOINTSTO_H
+
+#include "llvm/ADT/SparseBitVector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include <deque>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace llvm {
+
+/*
+ * The constraints of a function or a module.
+ * Every pointer value and every memory object (alloca or global) gets a node.
+ * The node of a memory object stands for the pointers stored in that object.
+ */
+class PointsToConstraints {
+  public:
+    enum Kind { AddressOf, Copy, Load, Store };
+
+    struct Constraint {
+        Kind kind;
+        unsigned dst;
+        unsigned src;
+    };
+
+    vector<Value *> nodeValues;     // node -> the pointer value or the memory object
+    vector<bool> isObject;          // node -> true if the node is a memory object
+    vector<Constraint> constraints;
+
+    unsigned numNodes() const { return nodeValues.size(); }
+
+    /*
+     * Add the constraints of F.
+     * If interprocedural is true, direct calls to defined functions also copy
+     * the actual arguments into the formal ones and the returned values into the call.
+     */
+    void addFunction(Function & F, bool interprocedural) {
+        for (inst_iterator it = inst_begin(F), E = inst_end(F); it != E; ++it) {
+            Instruction * I = &*it;
+
+            if (AllocaInst * alloca = dyn_cast<AllocaInst>(I)) {
+                add(AddressOf, getValueNode(alloca), getObjectNode(alloca));
+            }
+            else if (isa<BitCastInst>(I) || isa<GetElementPtrInst>(I)) {
+                addCopy(I, I->getOperand(0));
+            }
+            else if (SelectInst * select = dyn_cast<SelectInst>(I)) {
+                addCopy(I, select->getTrueValue());
+                addCopy(I, select->getFalseValue());
+            }
+            else if (PHINode * phi = dyn_cast<PHINode>(I)) {
+                for (Value * incoming : phi->incoming_values())
+                    addCopy(I, incoming);
+            }
+            else if (LoadInst * load = dyn_cast<LoadInst>(I)) {
+                if (load->getType()->isPointerTy() && hasNode(load->getPointerOperand()))
+                    add(Load, getValueNode(load), getValueNode(load->getPointerOperand()));
+            }
+            else if (StoreInst * store = dyn_cast<StoreInst>(I)) {
+                Value * val = store->getValueOperand();
+                Value * ptr = store->getPointerOperand();
+                if (val->getType()->isPointerTy() && hasNode(val) && hasNode(ptr))
+                    add(Store, getValueNode(ptr), getValueNode(val));
+            }
+            else if (CallInst * call = dyn_cast<CallInst>(I)) {
+                Function * callee = call->getCalledFunction();
+                if (!interprocedural || !callee || callee->isDeclaration())
+                    continue;
+
+                unsigned argNo = 0;
+                for (Argument & formal : callee->args()) {
+                    if (argNo >= call->arg_size())
+                        break;
+                    addCopy(&formal, call->getArgOperand(argNo++));
+                }
+                for (BasicBlock & B : *callee) {
+                    if (ReturnInst * ret = dyn_cast<ReturnInst>(B.getTerminator())) {
+                        if (ret->getReturnValue())
+                            addCopy(call, ret->getReturnValue());
+                    }
+                }
+            }
+        }
+    }
+
+    // pointers stored in the initializers of globals, e.g. @p = global i32* @x
+    void addGlobals(Module & M) {
+        for (GlobalVariable & global : M.globals()) {
+            if (global.hasInitializer() && hasNode(global.getInitializer()))
+                add(Store, getValueNode(&global), getValueNode(global.getInitializer()));
+        }
+    }
+
+    bool hasNode(Value * val) {
+        val = strip(val);
+        return val->getType()->isPointerTy() && !isa<ConstantPointerNull>(val) && !isa<UndefValue>(val);
+    }
+
+    unsigned getValueNode(Value * val) {
+        val = strip(val);
+        auto it = valueNode.find(val);
+        if (it != valueNode.end())
+            return it->second;
+
+        unsigned node = newNode(val, false);
+        valueNode[val] = node;
+        // a global used directly as an operand points to its own object
+        if (GlobalVariable * global = dyn_cast<GlobalVariable>(val))
+            add(AddressOf, node, getObjectNode(global));
+        return node;
+    }
+
+    unsigned getObjectNode(Value * val) {
+        auto it = objectNode.find(val);
+        if (it != objectNode.end())
+            return it->second;
+
+        unsigned node = newNode(val, true);
+        objectNode[val] = node;
+        return node;
+    }
+
+    // a node not attached to any value, e.g. a placeholder object or a temporary
+    unsigned addNode(bool object) {
+        return newNode(nullptr, object);
+    }
+
+    void addConstraint(Kind kind, unsigned dst, unsigned src) {
+        add(kind, dst, src);
+    }
+
+    bool hasValueNode(Value * val) const { return valueNode.count(val) != 0; }
+    bool hasObjectNode(Value * val) const { return objectNode.count(val) != 0; }
+
+    // constant casts and constant getelementptrs of globals are the global itself
+    static Value * strip(Value * val) {
+        if (!isa<Constant>(val))
+            return val;
+        while (true) {
+            val = val->stripPointerCasts();
+            if (GEPOperator * gep = dyn_cast<GEPOperator>(val))
+                val = gep->getPointerOperand();
+            else
+                return val;
+        }
+    }
+
+  private:
+    map<Value *, unsigned> valueNode;
+    map<Value *, unsigned> objectNode;
+
+    unsigned newNode(Value * val, bool object) {
+        nodeValues.push_back(val);
+        isObject.push_back(object);
+        return nodeValues.size() - 1;
+    }
+
+    void add(Kind kind, unsigned dst, unsigned src) {
+        constraints.push_back({kind, dst, src});
+    }
+
+    void addCopy(Value * dst, Value * src) {
+        if (dst->getType()->isPointerTy() && hasNode(src))
+            add(Copy, getValueNode(dst), getValueNode(src));
+    }
+};
+
+/*
+ * Steensgaard: every node has at most one pointee class, and both sides of a constraint
+ * are unified instead of included. Union by rank and path halving make it near-linear.
+ */
+class SteensgaardSolver {
+  public:
+    void solve(const PointsToConstraints & C) {
+        for (unsigned n = 0; n < C.numNodes(); n++)
+            makeNode();
+
+        for (auto const & c : C.constraints) {
+            switch (c.kind) {
+                case PointsToConstraints::AddressOf:
+                    unify(getPointee(c.dst), c.src);
+                    break;
+                case PointsToConstraints::Copy:
+                    unify(getPointee(c.dst), getPointee(c.src));
+                    break;
+                case PointsToConstraints::Load:
+                    unify(getPointee(c.dst), getPointee(getPointee(c.src)));
+                    break;
+                case PointsToConstraints::Store:
+                    unify(getPointee(getPointee(c.dst)), getPointee(c.src));
+                    break;
+            }
+        }
+
+        // the memory objects of every class
+        for (unsigned n = 0; n < C.numNodes(); n++) {
+            if (C.isObject[n])
+                classObjects[find(n)].push_back(n);
+        }
+    }
+
+    // memory object nodes node may point to
+    void getPointsTo(unsigned node, vector<unsigned> & objects) {
+        unsigned rep = find(node);
+        if (pointee[rep] < 0)
+            return;
+        auto it = classObjects.find(find(pointee[rep]));
+        if (it != classObjects.end())
+            objects = it->second;
+    }
+
+  private:
+    vector<unsigned> parent;
+    vector<unsigned> rank;
+    vector<int> pointee;    // pointee of a class representative, -1 if none yet
+    map<unsigned, vector<unsigned>> classObjects;
+
+    unsigned makeNode() {
+        parent.push_back(parent.size());
+        rank.push_back(0);
+        pointee.push_back(-1);
+        return parent.size() - 1;
+    }
+
+    unsigned find(unsigned n) {
+        while (parent[n] != n) {
+            parent[n] = parent[parent[n]];
+            n = parent[n];
+        }
+        return n;
+    }
+
+    unsigned getPointee(unsigned n) {
+        n = find(n);
+        if (pointee[n] < 0) {
+            unsigned fresh = makeNode();
+            pointee[n] = fresh;
+        }
+        return find(pointee[n]);
+    }
+
+    // unifying two classes also unifies their pointees, iteratively to keep the stack flat
+    void unify(unsigned a, unsigned b) {
+        vector<pair<unsigned, unsigned>> pending(1, make_pair(a, b));
+        while (!pending.empty()) {
+            a = find(pending.back().first);
+            b = find(pending.back().second);
+            pending.pop_back();
+            if (a == b)
+                continue;
+
+            if (rank[a] < rank[b])
+                swap(a, b);
+            if (rank[a] == rank[b])
+                rank[a]++;
+            parent[b] = a;
+
+            if (pointee[a] < 0)
+                pointee[a] = pointee[b];
+            else if (pointee[b] >= 0)
+                pending.push_back(make_pair(pointee[a], pointee[b]));
+        }
+    }
+};
+
+/*
+ * Andersen: worklist propagation on the inclusion graph.
+ * Copy edges n -> m mean pts(m) ⊇ pts(n); load and store constraints add copy edges as the points-to sets grow.
+ * Lazy cycle detection (Hardekopf & Lin): when an edge n -> m is found with pts(n) == pts(m),
+ * the strongly connected component around m is searched and collapsed into a single node.
+ */
+class AndersenSolver {
+  public:
+    void solve(const PointsToConstraints & C) {
+        unsigned N = C.numNodes();
+        parent.resize(N);
+        for (unsigned n = 0; n < N; n++)
+            parent[n] = n;
+        pts.resize(N);
+        copyEdges.resize(N);
+        loads.resize(N);
+        stores.resize(N);
+
+        for (auto const & c : C.constraints) {
+            switch (c.kind) {
+                case PointsToConstraints::AddressOf:
+                    pts[c.dst].set(c.src);
+                    break;
+                case PointsToConstraints::Copy:
+                    copyEdges[c.src].insert(c.dst);
+                    break;
+                case PointsToConstraints::Load:
+                    loads[c.src].push_back(c.dst);
+                    break;
+                case PointsToConstraints::Store:
+                    stores[c.dst].push_back(c.src);
+                    break;
+            }
+        }
+
+        for (unsigned n = 0; n < N; n++) {
+            if (!pts[n].empty())
+                push(n);
+        }
+
+        while (!worklist.empty()) {
+            unsigned n = find(worklist.front());
+            worklist.pop_front();
+            inWorklist.erase(n);
+
+            // complex constraints: p ⊇ *n and *n ⊇ q
+            for (unsigned o : pts[n]) {
+                for (unsigned p : loads[n]) {
+                    if (addEdge(o, p))
+                        push(find(o));
+                }
+                for (unsigned q : stores[n]) {
+                    if (addEdge(q, o))
+                        push(find(q));
+                }
+            }
+
+            vector<unsigned> succs(copyEdges[n].begin(), copyEdges[n].end());
+            for (unsigned m : succs) {
+                m = find(m);
+                n = find(n);
+                if (m == n)
+                    continue;
+
+                if (pts[m] == pts[n] && checkedEdges.insert(make_pair(n, m)).second && collapseCycle(m)) {
+                    m = find(m);
+                    n = find(n);
+                    if (m == n)
+                        continue;   // the edge is inside the collapsed cycle
+                }
+                if (pts[m] |= pts[n])
+                    push(m);
+            }
+        }
+    }
+
+    void getPointsTo(unsigned node, vector<unsigned> & objects) {
+        for (unsigned o : pts[find(node)])
+            objects.push_back(o);
+    }
+
+  private:
+    vector<unsigned> parent;
+    vector<SparseBitVector<>> pts;
+    vector<set<unsigned>> copyEdges;
+    vector<vector<unsigned>> loads;     // n -> p for p ⊇ *n
+    vector<vector<unsigned>> stores;    // n -> q for *n ⊇ q
+    deque<unsigned> worklist;
+    set<unsigned> inWorklist;
+    set<pair<unsigned, unsigned>> checkedEdges;
+
+    unsigned find(unsigned n) {
+        while (parent[n] != n) {
+            parent[n] = parent[parent[n]];
+            n = parent[n];
+        }
+        return n;
+    }
+
+    void push(unsigned n) {
+        if (inWorklist.insert(n).second)
+            worklist.push_back(n);
+    }
+
+    // add the copy edge src -> dst, returns true if it is new
+    bool addEdge(unsigned src, unsigned dst) {
+        src = find(src);
+        dst = find(dst);
+        if (src == dst)
+            return false;
+        return copyEdges[src].insert(dst).second;
+    }
+
+    /*
+     * Iterative Tarjan from start over the copy edges.
+     * Every strongly connected component found is merged into its root, which goes back on the worklist: its
+     * points-to set, copy edges and complex constraints grew. start is the root of its own component (the search
+     * starts there); returns true if that component has more than one node.
+     */
+    bool collapseCycle(unsigned start) {
+        map<unsigned, unsigned> dfsIndex, lowLink;
+        vector<unsigned> stack;
+        set<unsigned> onStack;
+        vector<pair<unsigned, vector<unsigned>>> frames;    // node and its remaining successors
+        bool merged = false;
+
+        auto visit = [&](unsigned n) {
+            unsigned id = dfsIndex.size();
+            dfsIndex[n] = id;
+            lowLink[n] = id;
+            stack.push_back(n);
+            onStack.insert(n);
+            vector<unsigned> succs;
+            for (unsigned m : copyEdges[n])
+                succs.push_back(find(m));
+            frames.push_back(make_pair(n, succs));
+        };
+
+        visit(start);
+        while (!frames.empty()) {
+            unsigned n = frames.back().first;
+            vector<unsigned> & succs = frames.back().second;
+
+            if (!succs.empty()) {
+                unsigned m = succs.back();
+                succs.pop_back();
+                if (dfsIndex.count(m) == 0)
+                    visit(m);
+                else if (onStack.count(m) != 0)
+                    lowLink[n] = min(lowLink[n], dfsIndex[m]);
+                continue;
+            }
+
+            frames.pop_back();
+            if (!frames.empty()) {
+                unsigned caller = frames.back().first;
+                lowLink[caller] = min(lowLink[caller], lowLink[n]);
+            }
+            if (lowLink[n] != dfsIndex[n])
+                continue;
+
+            // n is the root of a component
+            bool cycle = false;
+            while (true) {
+                unsigned m = stack.back();
+                stack.pop_back();
+                onStack.erase(m);
+                if (m == n)
+                    break;
+                merge(n, m);
+                cycle = true;
+            }
+            if (cycle) {
+                push(n);
+                if (n == start)
+                    merged = true;
+            }
+        }
+        return merged;
+    }
+
+    void merge(unsigned rep, unsigned other) {
+        parent[other] = rep;
+        pts[rep] |= pts[other];
+        copyEdges[rep].insert(copyEdges[other].begin(), copyEdges[other].end());
+        copyEdges[rep].erase(rep);
+        copyEdges[rep].erase(other);
+        loads[rep].insert(loads[rep].end(), loads[other].begin(), loads[other].end());
+        stores[rep].insert(stores[rep].end(), stores[other].begin(), stores[other].end());
+        pts[other].clear();
+        copyEdges[other].clear();
+        loads[other].clear();
+        stores[other].clear();
+    }
+};
+
+}
+#endif // End LLVM_TRANSFORMS_FLOWINSENSITIVEPOINTSTO_H
@@ -5,9 +5,15 @@ Liveness Analysis
 */
 #include "231DFA.h"
 #include "llvm/Pass.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
+#include <cmath>
 #include <string>
 #include <vector>
 #include <set>
@@ -15,6 +21,23 @@ Liveness Analysis
 using namespace llvm;
 using namespace std;
 
+// opt -load submission_pt3.so -cse231-liveness -cse231-liveness-ssa < input.ll > /dev/null
+static cl::opt<bool> SSALiveness("cse231-liveness-ssa",
+    cl::desc("Compute liveness directly from SSA def-use chains instead of the iterative worklist"),
+    cl::init(false));
+
+// opt -load submission_pt3.so -cse231-liveness -cse231-liveness-pressure=10 -cse231-liveness-pressure-format=csv < input.ll > /dev/null
+static cl::opt<unsigned> PressureTopN("cse231-liveness-pressure",
+    cl::desc("Report the N blocks/loops of the module with the highest register pressure instead of the per-edge liveness"),
+    cl::init(0));
+
+enum PressureFormatKind { PressureJSON, PressureCSV };
+static cl::opt<PressureFormatKind> PressureFormat("cse231-liveness-pressure-format",
+    cl::desc("Format of the register-pressure report"),
+    cl::values(clEnumValN(PressureJSON, "json", "JSON array"),
+               clEnumValN(PressureCSV, "csv", "CSV with a header row")),
+    cl::init(PressureJSON));
+
 namespace {
     // similar to ReachingInfo class implemented in ReachingDefinitionAnalysis.cpp
     class LivenessInfo : public Info {
@@ -162,21 +185,364 @@ namespace {
             delete livenessInfo;
             delete info_in;
         }
+
+        /*  SSA Liveness
+            In SSA form every variable has exactly one definition which dominates all its uses, 
+            so liveness can be answered without any fixpoint iteration:
+            a variable v is live-in at block B iff B lies on a path from B to a use of v that does not pass through def(v).
+
+            Path exploration (Brandner et al., "Computing Liveness Sets for SSA-Form Programs"):
+                for each use of v, walk the CFG backwards from the block of the use 
+                (or from the incoming block if the use is a phi) and stop at the block of def(v) 
+                or at a block already marked for v.
+            Each block is visited at most once per variable, so the cost is linear in the size of the live ranges.
+
+            The per-block live-in sets are then expanded into the DFA CFG edges with one backward scan of each block,
+            so print() produces the same format as runWorklistAlgorithm().
+            Unlike the category table in flowfunction, every instruction kills its own index here (e.g. call and cast results).
+        */
+        void runSSALiveness(Function *func)
+        {
+            this->initializeMap(func);
+
+            // number the basic blocks
+            vector<BasicBlock *> blocks;
+            map<BasicBlock *, unsigned> blockToIndex;
+            for (BasicBlock &B : *func)
+            {
+                blockToIndex[&B] = blocks.size();
+                blocks.push_back(&B);
+            }
+
+            // step 1: live-in set of every block (phi definitions and phi uses excluded)
+            // liveIn[b] is filled in increasing order of the variable index, so it stays sorted
+            vector<vector<unsigned>> liveIn(blocks.size());
+            vector<unsigned> marked(blocks.size(), 0); // last variable marked live-in at the block (indices are > 0)
+            vector<unsigned> worklist;
+
+            for (inst_iterator ii = inst_begin(func), ie = inst_end(func); ii != ie; ++ii)
+            {
+                Instruction *def = &*ii;
+                unsigned v = this->getIndexFromInstr(def);
+                unsigned defBlock = blockToIndex[def->getParent()];
+
+                for (User *user : def->users())
+                {
+                    Instruction *useInstr = dyn_cast<Instruction>(user);
+                    if (!useInstr || useInstr->getParent()->getParent() != func)
+                        continue;
+
+                    if (PHINode *phi = dyn_cast<PHINode>(useInstr))
+                    {
+                        // a phi uses its operand at the end of the incoming block
+                        for (unsigned j = 0; j < phi->getNumIncomingValues(); j++)
+                        {
+                            if (phi->getIncomingValue(j) == def)
+                                worklist.push_back(blockToIndex[phi->getIncomingBlock(j)]);
+                        }
+                    }
+                    else
+                    {
+                        worklist.push_back(blockToIndex[useInstr->getParent()]);
+                    }
+                }
+
+                // up and mark
+                while (!worklist.empty())
+                {
+                    unsigned b = worklist.back();
+                    worklist.pop_back();
+
+                    if (b == defBlock || marked[b] == v)
+                        continue;
+
+                    marked[b] = v;
+                    liveIn[b].push_back(v);
+                    for (auto pi = pred_begin(blocks[b]), pe = pred_end(blocks[b]); pi != pe; ++pi)
+                    {
+                        worklist.push_back(blockToIndex[*pi]);
+                    }
+                }
+            }
+
+            // step 2: expand into the DFA CFG edges
+            for (BasicBlock *block : blocks)
+            {
+                Instruction *term = (Instruction *)block->getTerminator();
+                unsigned termIndex = this->getIndexFromInstr(term);
+                set<unsigned> live;
+
+                // edges from the successors: live-in of the successor plus the phi operands coming from this block
+                for (auto si = succ_begin(block), se = succ_end(block); si != se; ++si)
+                {
+                    BasicBlock *succ = *si;
+                    LivenessInfo *succInfo = new LivenessInfo();
+                    const vector<unsigned> &succLiveIn = liveIn[blockToIndex[succ]];
+                    succInfo->info.insert(succLiveIn.begin(), succLiveIn.end());
+
+                    for (PHINode &phi : succ->phis())
+                    {
+                        Instruction *phiValue = dyn_cast<Instruction>(phi.getIncomingValueForBlock(block));
+                        if (phiValue && this->countInstructions(phiValue) != 0)
+                        {
+                            succInfo->info.insert(this->getIndexFromInstr(phiValue));
+                        }
+                    }
+
+                    live.insert(succInfo->info.begin(), succInfo->info.end());
+                    this->setInfoToEdge(make_pair(this->getIndexFromInstr(&(succ->front())), termIndex), succInfo);
+                }
+
+                // backward scan from the terminator to the first non-phi instruction
+                Instruction *firstNonPhi = block->getFirstNonPHI();
+                for (Instruction *I = term;; I = I->getPrevNode())
+                {
+                    unsigned index = this->getIndexFromInstr(I);
+                    live.erase(index);
+                    for (unsigned i = 0; i < I->getNumOperands(); ++i)
+                    {
+                        Instruction *instr = dyn_cast<Instruction>(I->getOperand(i));
+                        if (instr && this->countInstructions(instr) != 0)
+                        {
+                            live.insert(this->getIndexFromInstr(instr));
+                        }
+                    }
+
+                    LivenessInfo *edgeInfo = new LivenessInfo();
+                    edgeInfo->info = live;
+
+                    if (I != firstNonPhi)
+                    {
+                        this->setInfoToEdge(make_pair(index, this->getIndexFromInstr(I->getPrevNode())), edgeInfo);
+                        continue;
+                    }
+
+                    // the edges to the predecessors were already set by step 2 of each predecessor
+                    if (isa<PHINode>(&(block->front())))
+                    {
+                        this->setInfoToEdge(make_pair(index, this->getIndexFromInstr(&(block->front()))), edgeInfo);
+                    }
+                    else
+                    {
+                        delete edgeInfo;
+                    }
+                    break;
+                }
+            }
+        }
+    };
+
+    /*  Register Pressure
+        The pressure at a program point is the size of the live set on its DFA edge.
+        In the backward DFA CFG the edge src->dst is the point right after dst, so it belongs to the block of dst.
+        A block reports its maximum point, a loop the maximum point over all of its blocks.
+        The weighted pressure scales the maximum by 10^(loop depth), the usual static estimate of how often the point executes.
+    */
+    struct PressurePoint
+    {
+        string function;
+        string kind;            // "block" or "loop"
+        string label;           // block name, or the header block name for a loop
+        unsigned block;         // DFA index of the first instruction of the block (or loop header)
+        unsigned depth;
+        unsigned maxLive;
+        double weighted;
+        pair<unsigned, unsigned> edge;  // the edge where the maximum is reached
+        vector<pair<unsigned, string>> values;  // index and opcode name of the live values at that edge
+
+        bool operator<(const PressurePoint &other) const
+        {
+            if (weighted != other.weighted)
+                return weighted > other.weighted;
+            return maxLive > other.maxLive;
+        }
     };
 
     struct LivenessAnalysisPass : public FunctionPass{
         static char ID;
+        vector<PressurePoint> pressurePoints;
 
         LivenessAnalysisPass() : FunctionPass(ID) {}
 
+        void getAnalysisUsage(AnalysisUsage &AU) const override
+        {
+            AU.addRequired<LoopInfoWrapperPass>();
+            AU.setPreservesAll();
+        }
+
         bool runOnFunction(Function &F) override
         {
             LivenessInfo bot;
             LivenessAnalysis la(bot, bot);
-            la.runWorklistAlgorithm(&F);
-            la.print();
+            if (SSALiveness)
+                la.runSSALiveness(&F);
+            else
+                la.runWorklistAlgorithm(&F);
+
+            if (PressureTopN == 0)
+                la.print();
+            else
+                collectPressure(F, la, getAnalysis<LoopInfoWrapperPass>().getLoopInfo());
             return false;
         }
+
+        void collectPressure(Function &F, LivenessAnalysis &la, LoopInfo &LI)
+        {
+            // maximum point of every block
+            map<BasicBlock *, pair<unsigned, unsigned>> blockMaxEdge;
+            map<BasicBlock *, unsigned> blockMaxLive;
+            for (auto const &it : la.getEdgeToInfo())
+            {
+                Instruction *dst = la.getInstrFromIndex(it.first.second);
+                if (it.first.first == 0 || !dst)
+                    continue;
+
+                BasicBlock *block = dst->getParent();
+                unsigned size = it.second->info.size();
+                if (blockMaxLive.count(block) == 0 || size > blockMaxLive[block])
+                {
+                    blockMaxLive[block] = size;
+                    blockMaxEdge[block] = it.first;
+                }
+            }
+
+            for (BasicBlock &block : F)
+            {
+                if (blockMaxLive.count(&block) != 0)
+                    pressurePoints.push_back(makePoint(F, la, "block", &block, LI.getLoopDepth(&block), blockMaxEdge[&block]));
+            }
+
+            for (Loop *L : LI.getLoopsInPreorder())
+            {
+                BasicBlock *hottest = nullptr;
+                for (BasicBlock *block : L->blocks())
+                {
+                    if (blockMaxLive.count(block) != 0 && (!hottest || blockMaxLive[block] > blockMaxLive[hottest]))
+                        hottest = block;
+                }
+                if (!hottest)
+                    continue;
+
+                pressurePoints.push_back(makePoint(F, la, "loop", L->getHeader(), L->getLoopDepth(), blockMaxEdge[hottest]));
+            }
+        }
+
+        PressurePoint makePoint(Function &F, LivenessAnalysis &la, string kind, BasicBlock *block,
+                                unsigned depth, pair<unsigned, unsigned> edge)
+        {
+            PressurePoint point;
+            point.function = F.getName().str();
+            point.kind = kind;
+            point.label = block->getName().str();
+            point.block = la.getIndexFromInstr(&(block->front()));
+            point.depth = depth;
+            point.edge = edge;
+
+            for (auto index : la.getInfoFromEdge(edge)->info)
+            {
+                point.values.push_back(make_pair(index, string(la.getInstrFromIndex(index)->getOpcodeName())));
+            }
+            point.maxLive = point.values.size();
+            point.weighted = point.maxLive * pow(10.0, depth);
+            return point;
+        }
+
+        // the report covers the whole module, so it is printed once all functions are processed
+        bool doFinalization(Module &M) override
+        {
+            if (PressureTopN == 0)
+                return false;
+
+            stable_sort(pressurePoints.begin(), pressurePoints.end());
+            if (pressurePoints.size() > PressureTopN)
+                pressurePoints.resize(PressureTopN);
+
+            if (PressureFormat == PressureCSV)
+                printPressureCSV();
+            else
+                printPressureJSON();
+
+            pressurePoints.clear();
+            return false;
+        }
+
+        // a JSON string literal: quotes and backslashes escaped, control characters as \uXXXX
+        static void printJSONString(raw_ostream &out, StringRef text)
+        {
+            out << '"';
+            for (unsigned char c : text)
+            {
+                if (c == '"' || c == '\\')
+                    out << '\\' << c;
+                else if (c < 0x20)
+                    out << format("\\u%04x", c);
+                else
+                    out << c;
+            }
+            out << '"';
+        }
+
+        // a quoted CSV field (RFC 4180): embedded quotes are doubled
+        static void printCSVField(raw_ostream &out, StringRef text)
+        {
+            out << '"';
+            for (char c : text)
+            {
+                if (c == '"')
+                    out << '"';
+                out << c;
+            }
+            out << '"';
+        }
+
+        void printPressureCSV()
+        {
+            errs() << "function,kind,label,block,depth,max_live,weighted,edge,values\n";
+            for (auto const &point : pressurePoints)
+            {
+                printCSVField(errs(), point.function);
+                errs() << ',' << point.kind << ',';
+                printCSVField(errs(), point.label);
+                errs() << ',' << point.block << ',' << point.depth << ','
+                       << point.maxLive << ',' << format("%.0f", point.weighted) << ','
+                       << point.edge.first << "->" << point.edge.second << ',';
+                // values are separated by '|' like the per-edge output, e.g. 3:load|7:add|
+                for (auto value : point.values)
+                {
+                    errs() << value.first << ':' << value.second << '|';
+                }
+                errs() << "\n";
+            }
+        }
+
+        void printPressureJSON()
+        {
+            errs() << "[\n";
+            for (unsigned i = 0; i < pressurePoints.size(); i++)
+            {
+                auto const &point = pressurePoints[i];
+                errs() << "  {\"function\": ";
+                printJSONString(errs(), point.function);
+                errs() << ", \"kind\": ";
+                printJSONString(errs(), point.kind);
+                errs() << ", \"label\": ";
+                printJSONString(errs(), point.label);
+                errs() << ", \"block\": " << point.block
+                       << ", \"depth\": " << point.depth
+                       << ", \"max_live\": " << point.maxLive
+                       << ", \"weighted\": " << format("%.0f", point.weighted)
+                       << ", \"edge\": [" << point.edge.first << ", " << point.edge.second << "]"
+                       << ", \"values\": [";
+                for (unsigned j = 0; j < point.values.size(); j++)
+                {
+                    errs() << (j ? ", " : "") << "{\"index\": " << point.values[j].first << ", \"opcode\": ";
+                    printJSONString(errs(), point.values[j].second);
+                    errs() << "}";
+                }
+                errs() << "]}" << (i + 1 < pressurePoints.size() ? "," : "") << "\n";
+            }
+            errs() << "]\n";
+        }
     };
 }
 
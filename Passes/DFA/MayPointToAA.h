@@ -0,0 +1,190 @@
+/*  May-point-to Alias Analysis
+    Exposes the module-wide Andersen points-to sets as an LLVM alias analysis, so that GVN, LICM, DSE
+    or MemorySSA can use them through AAResults.
+
+    The constraints are solved once, then frozen into an index: every pointer value maps to the ID of its
+    (sorted, deduplicated) object set. alias() only looks up the two IDs and compares the sets.
+
+    What the constraints cannot see is modeled by an unknown object U and a pointer to it:
+        - pointers coming from outside (arguments of externally visible functions, results of calls to
+          declarations or indirect calls, inttoptr and other unhandled instructions) point to U and to
+          every escaped object;
+        - pointers passed to declarations, cast to integers, stored in escaped memory, returned or held by externally
+          visible globals escape: U then points to their objects, which may be overwritten with U.
+    Two pointers are NoAlias only if both sets are known, non-empty, free of U and disjoint.
+*/
+#ifndef LLVM_TRANSFORMS_MAYPOINTTOAA_H
+#define LLVM_TRANSFORMS_MAYPOINTTOAA_H
+
+#include "FlowInsensitivePointsTo.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/IR/ValueMap.h"
+#include <algorithm>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+namespace llvm {
+
+class PointsToIndex {
+  public:
+    void build(Module & M) {
+        PointsToConstraints C;
+        C.addGlobals(M);
+        for (Function & F : M) {
+            if (!F.isDeclaration())
+                C.addFunction(F, true);
+        }
+
+        unsigned unknown = C.addNode(true);
+        unsigned unknownPtr = C.addNode(false);
+        C.addConstraint(PointsToConstraints::AddressOf, unknownPtr, unknown);
+        C.addConstraint(PointsToConstraints::AddressOf, unknown, unknown);
+        // U reaches every escaped object, which outside code may overwrite with anything it reaches
+        C.addConstraint(PointsToConstraints::Load, unknownPtr, unknownPtr);
+        C.addConstraint(PointsToConstraints::Store, unknownPtr, unknownPtr);
+
+        auto fromOutside = [&](Value * val) {
+            if (C.hasNode(val))
+                C.addConstraint(PointsToConstraints::Copy, C.getValueNode(val), unknownPtr);
+        };
+        auto escape = [&](Value * val) {
+            if (C.hasNode(val))
+                C.addConstraint(PointsToConstraints::Store, unknownPtr, C.getValueNode(val));
+        };
+
+        for (GlobalVariable & global : M.globals()) {
+            if (!global.hasLocalLinkage())
+                escape(&global);
+        }
+
+        for (Function & F : M) {
+            if (F.isDeclaration())
+                continue;
+
+            if (!calledOnlyDirectly(F)) {
+                for (Argument & arg : F.args())
+                    fromOutside(&arg);
+                for (BasicBlock & B : F) {
+                    if (ReturnInst * ret = dyn_cast<ReturnInst>(B.getTerminator())) {
+                        if (ret->getReturnValue())
+                            escape(ret->getReturnValue());
+                    }
+                }
+            }
+
+            for (inst_iterator it = inst_begin(F), E = inst_end(F); it != E; ++it) {
+                Instruction * I = &*it;
+                CallInst * call = dyn_cast<CallInst>(I);
+                bool defined = call && call->getCalledFunction() && !call->getCalledFunction()->isDeclaration();
+
+                if (I->getType()->isPointerTy() && !defined &&
+                    !isa<AllocaInst>(I) && !isa<BitCastInst>(I) && !isa<GetElementPtrInst>(I) &&
+                    !isa<SelectInst>(I) && !isa<PHINode>(I) && !isa<LoadInst>(I))
+                    fromOutside(I);
+
+                // pointers handed to code that is not analyzed, or hidden in integers and aggregates
+                bool unmodeled = isa<PtrToIntInst>(I) || isa<InsertValueInst>(I) || isa<InsertElementInst>(I) ||
+                                 isa<AtomicCmpXchgInst>(I) || isa<AtomicRMWInst>(I) ||
+                                 (isa<CallInst>(I) && !defined) || (!isa<CallInst>(I) && isa<CallBase>(I));
+                if (unmodeled) {
+                    for (Value * operand : I->operands())
+                        escape(operand);
+                }
+            }
+        }
+
+        AndersenSolver solver;
+        solver.solve(C);
+
+        map<vector<unsigned>, unsigned> setIDs;
+        sets.push_back(vector<unsigned>());     // 0: unknown pointer
+        hasUnknown.push_back(true);
+        vector<unsigned> objects;
+        for (unsigned node = 0; node < C.numNodes(); node++) {
+            Value * val = C.nodeValues[node];
+            if (C.isObject[node] || !val)
+                continue;
+
+            objects.clear();
+            solver.getPointsTo(node, objects);
+            std::sort(objects.begin(), objects.end());
+            objects.erase(std::unique(objects.begin(), objects.end()), objects.end());
+
+            auto it = setIDs.find(objects);
+            if (it == setIDs.end()) {
+                it = setIDs.insert(make_pair(objects, (unsigned)sets.size())).first;
+                sets.push_back(objects);
+                hasUnknown.push_back(objects.empty() || std::binary_search(objects.begin(), objects.end(), unknown));
+            }
+            setOf[val] = it->second;
+        }
+    }
+
+    bool isNoAlias(const Value * A, const Value * B) const {
+        unsigned a = lookup(A);
+        unsigned b = lookup(B);
+        if (hasUnknown[a] || hasUnknown[b] || a == b)
+            return false;
+
+        const vector<unsigned> & x = sets[a];
+        const vector<unsigned> & y = sets[b];
+        for (unsigned i = 0, j = 0; i < x.size() && j < y.size(); ) {
+            if (x[i] == y[j])
+                return false;
+            if (x[i] < y[j])
+                i++;
+            else
+                j++;
+        }
+        return true;
+    }
+
+    unsigned numSets() const { return sets.size() - 1; }
+    unsigned numPointers() const { return setOf.size(); }
+
+  private:
+    // values deleted by later passes leave the map, RAUW moves their entry to the replacement
+    ValueMap<const Value *, unsigned> setOf;
+    vector<vector<unsigned>> sets;
+    vector<bool> hasUnknown;
+
+    unsigned lookup(const Value * val) const {
+        if (!val)
+            return 0;
+        auto it = setOf.find(PointsToConstraints::strip(const_cast<Value *>(val)));
+        return it == setOf.end() ? 0 : it->second;
+    }
+
+    // internal functions whose every use is the callee of a CallInst get their arguments from addFunction
+    static bool calledOnlyDirectly(Function & F) {
+        if (!F.hasLocalLinkage())
+            return false;
+        for (User * user : F.users()) {
+            CallInst * call = dyn_cast<CallInst>(user);
+            if (!call || call->getCalledFunction() != &F)
+                return false;
+        }
+        return true;
+    }
+};
+
+class MayPointToAAResult : public AAResultBase<MayPointToAAResult> {
+    friend AAResultBase<MayPointToAAResult>;
+
+  public:
+    explicit MayPointToAAResult(const PointsToIndex & index) : AAResultBase(), index(index) {}
+
+    AliasResult alias(const MemoryLocation & LocA, const MemoryLocation & LocB, AAQueryInfo & AAQI) {
+        if (index.isNoAlias(LocA.Ptr, LocB.Ptr))
+            return AliasResult::NoAlias;
+        return AAResultBase::alias(LocA, LocB, AAQI);
+    }
+
+  private:
+    const PointsToIndex & index;
+};
+
+}
+#endif // End LLVM_TRANSFORMS_MAYPOINTTOAA_H
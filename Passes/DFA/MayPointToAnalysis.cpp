@@ -1,9 +1,13 @@
 /*  May-point-to Analysis
     In part 3, you will also need to implement a may-point-to analysis based on the framework you implemented.
 */
-#include "231DFA.h"
+#include "MayPointToAnalysis.h"
+#include "MayPointToAA.h"
+#include "FlowInsensitivePointsTo.h"
 #include "llvm/Pass.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include <string>
 #include <vector>
@@ -12,284 +16,247 @@
 using namespace llvm;
 using namespace std;
 
-namespace
-{
-    class MayPointToInfo : public Info
-    {
-    public:
-        /*  Let Pointers be the set of the DFA identifiers of the pointers in the function (including IR pointers and memory pointers) 
-            and MemoryObjects the set of the DFA identifiers of the memory objects allocated in the function. 
-            The domain D for this analysis is Powerset(S), where S={p → o | p ∊ Pointers && o ∊ MemoryObjects}. 
-        */
-        map<unsigned, set<unsigned>> pointerMap;
+enum PointsToMode { FlowSensitive, Steensgaard, Andersen };
 
-        MayPointToInfo() : Info() {}
+// opt -load submission_pt3.so -cse231-maypointto -cse231-maypointto-mode=andersen [-cse231-maypointto-module] < input.ll > /dev/null
+static cl::opt<PointsToMode> Mode("cse231-maypointto-mode",
+    cl::desc("Solver used by the may-point-to analysis"),
+    cl::values(clEnumValN(FlowSensitive, "flow", "flow-sensitive, one map per DFA edge"),
+               clEnumValN(Steensgaard, "steensgaard", "flow-insensitive unification, one map per function/module"),
+               clEnumValN(Andersen, "andersen", "flow-insensitive inclusion, one map per function/module")),
+    cl::init(FlowSensitive));
 
-        MayPointToInfo(const MayPointToInfo &other) : Info(other)
-        {
-            pointerMap = other.pointerMap;
-        }
+// opt -load submission_pt3.so -cse231-maypointto -cse231-maypointto-interprocedural [-cse231-maypointto-threads=8] < input.ll > /dev/null
+static cl::opt<bool> Interprocedural("cse231-maypointto-interprocedural",
+    cl::desc("Apply bottom-up callee summaries at call sites in the flow-sensitive mode"),
+    cl::init(false));
 
-        ~MayPointToInfo() {}
+static cl::opt<unsigned> SummaryThreads("cse231-maypointto-threads",
+    cl::desc("Number of threads summarizing the call-graph SCCs of a level"),
+    cl::init(1));
 
-        /*
-            The output should be in the following form:
-                Edge[space][src]->Edge[space][dst]:[point-to 1]|[point-to 2]| ... [point-to K]|
+static cl::opt<bool> ModuleScope("cse231-maypointto-module",
+    cl::desc("Solve the flow-insensitive modes once for the whole module, through direct calls"),
+    cl::init(false));
 
-            EX
-            opt -load  submission_pt3.so  -cse231-maypointto </tests/test-example/test1.ll>   /dev/null
-            Edge 0->Edge 1:
-            Edge 1->Edge 2:R1->(M1/)|
-            Edge 2->Edge 3:R1->(M1/)|R2->(M2/)|
-            Edge 3->Edge 4:R1->(M1/)|R2->(M2/)|
-            Edge 4->Edge 5:R1->(M1/)|R2->(M2/)|
-            Edge 5->Edge 6:R1->(M1/)|R2->(M2/)|
-            Edge 6->Edge 7:R1->(M1/)|R2->(M2/)|
-            Edge 7->Edge 8:R1->(M1/)|R2->(M2/)|
-            Edge 7->Edge 12:R1->(M1/)|R2->(M2/)|
-            Edge 8->Edge 9:R1->(M1/)|R2->(M2/)|
-            Edge 9->Edge 10:R1->(M1/)|R2->(M2/)|
-            Edge 10->Edge 11:R1->(M1/)|R2->(M2/)|
-            Edge 11->Edge 16:R1->(M1/)|R2->(M2/)|
-            Edge 12->Edge 13:R1->(M1/)|R2->(M2/)|
-            Edge 13->Edge 14:R1->(M1/)|R2->(M2/)|
-            Edge 14->Edge 15:R1->(M1/)|R2->(M2/)|
-            Edge 15->Edge 16:R1->(M1/)|R2->(M2/)|
-            Edge 16->Edge 17:R1->(M1/)|R2->(M2/)|
-            Edge 17->Edge 18:R1->(M1/)|R2->(M2/)|
-            Edge 18->Edge 19:R1->(M1/)|R2->(M2/)|
-        */
-        void print()
+namespace
+{
+    // DFA index of an alloca within its own function
+    unsigned getAllocaIndex(Instruction *alloca)
+    {
+        unsigned counter = 1;
+        for (inst_iterator I = inst_begin(alloca->getParent()->getParent()), E = inst_end(alloca->getParent()->getParent()); I != E; ++I, ++counter)
         {
-            for (auto entry: pointerMap) {
-				if (entry.second.size() == 0)
-					continue;
+            if (&*I == alloca)
+                break;
+        }
+        return counter;
+    }
 
-				errs() << "R" << entry.first << "->(";
+    /*
+        Output of the flow-insensitive modes, one line per function:
+            Function[space][name]:[point-to 1]|[point-to 2]| ... [point-to K]|
+        Registers are printed first (R[index]->(...)), then the memory objects of the function and
+        the globals it uses (M[index]->(...), @[name]->(...)).
+        Memory objects are M[index] for allocas of the function, [function].M[index] for allocas of
+        other functions (module scope only) and @[name] for globals.
+    */
+    template <class Solver>
+    void printFlowInsensitive(Function &F, PointsToConstraints &C, Solver &solver)
+    {
+        map<Value *, unsigned> index;
+        unsigned counter = 1;
+        for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
+            index[&*I] = counter++;
 
-				for (auto mi : entry.second) {
-					errs() << "M" << to_string(mi & (~(1 << 15))) << "/";
-				}
-				errs() << ")|";
-			}
-			errs() << "\n";
-        }
+        auto printObject = [&](Value *object) {
+            if (GlobalVariable *global = dyn_cast<GlobalVariable>(object))
+            {
+                errs() << "@" << global->getName();
+                return;
+            }
+            Instruction *alloca = cast<Instruction>(object);
+            if (alloca->getParent()->getParent() != &F)
+                errs() << alloca->getParent()->getParent()->getName() << ".M" << getAllocaIndex(alloca);
+            else
+                errs() << "M" << index[alloca];
+        };
 
-        static bool equals(MayPointToInfo *info1, MayPointToInfo *info2)
+        auto printEntry = [&](unsigned node) {
+            vector<unsigned> objects;
+            solver.getPointsTo(node, objects);
+            if (objects.empty())
+                return;
+            errs() << "->(";
+            for (auto o : objects)
+            {
+                printObject(C.nodeValues[o]);
+                errs() << "/";
+            }
+            errs() << ")|";
+        };
+
+        errs() << "Function " << F.getName() << ":";
+        for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
         {
-            return info1->pointerMap == info2->pointerMap;
+            Instruction *instr = &*I;
+            if (!C.hasValueNode(instr))
+                continue;
+            vector<unsigned> objects;
+            solver.getPointsTo(C.getValueNode(instr), objects);
+            if (objects.empty())
+                continue;
+            errs() << "R" << index[instr];
+            printEntry(C.getValueNode(instr));
         }
 
-        static void *join(MayPointToInfo *info1, MayPointToInfo *info2, MayPointToInfo *result)
+        // memory objects: allocas of F, then globals used by F
+        set<GlobalVariable *> globals;
+        for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
         {
-            result->pointerMap = info1->pointerMap;
-            for (auto entry : info2->pointerMap)
+            for (Use &operand : I->operands())
             {
-                if (!entry.second.empty())
-                {
-                    result->pointerMap[entry.first].insert(entry.second.begin(), entry.second.end());
-                }
+                if (GlobalVariable *global = dyn_cast<GlobalVariable>(operand->stripPointerCasts()))
+                    globals.insert(global);
             }
-            return nullptr;
         }
-    };
-
-    class MayPointToAnalysis : public DataFlowAnalysis<MayPointToInfo, true>
-    {
-    public:
-        MayPointToAnalysis(MayPointToInfo &bottom, MayPointToInfo &initialState) : 
-        DataFlowAnalysis<MayPointToInfo, true>::DataFlowAnalysis(bottom, initialState) {}
-
-        ~MayPointToAnalysis() {}
+        vector<Value *> objects;
+        for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
+        {
+            if (isa<AllocaInst>(&*I))
+                objects.push_back(&*I);
+        }
+        for (GlobalVariable &global : F.getParent()->globals())
+        {
+            if (globals.count(&global) != 0)
+                objects.push_back(&global);
+        }
 
-        void flowfunction(Instruction *I,
-                        std::vector<unsigned> &IncomingEdges,
-                        std::vector<unsigned> &OutgoingEdges,
-                        std::vector<MayPointToInfo *> &Infos)
+        for (Value *object : objects)
         {
-            auto *infoIn = new MayPointToInfo();
-            unsigned index = this->getIndexFromInstr(I);
-            
-            // Step 1: merge all incoming edges with the join operation.
-            for (auto start : IncomingEdges)
-            {
-                auto edge = make_pair(start, index);
-                MayPointToInfo::join(infoIn, this->getInfoFromEdge(edge), infoIn);
-            }
+            if (!C.hasObjectNode(object))
+                continue;
+            unsigned node = C.getObjectNode(object);
+            vector<unsigned> contents;
+            solver.getPointsTo(node, contents);
+            if (contents.empty())
+                continue;
+            printObject(object);
+            printEntry(node);
+        }
+        errs() << "\n";
+    }
 
-            // Step 2: identify the opcode name 
-            string opName(I->getOpcodeName());
+    template <class Solver>
+    void solveAndPrint(Module &M, vector<Function *> functions, bool interprocedural)
+    {
+        PointsToConstraints C;
+        C.addGlobals(M);
+        for (Function *F : functions)
+            C.addFunction(*F, interprocedural);
 
-            /*  alloca
-                out = in U {Ri->Mi} */
-            if (opName == "alloca")
-            {
-                // convert IR to MemoryObject and allocate the instruction into pointerMap
-                unsigned instrIndex = index | (1 << 15);
-                infoIn->pointerMap[index].insert(instrIndex);
-            }
+        Solver solver;
+        solver.solve(C);
+        for (Function *F : functions)
+            printFlowInsensitive(*F, C, solver);
+    }
 
-            /*  bitcast OR  getelementptr
-                out = in U {Ri->X | Rv -> X } 
-                where Rv is the DFA identifier of <value>.  */
-            if (opName == "bitcast" || opName == "getelementptr")
-            {
-                Instruction *instruction = (Instruction *)I->getOperand(0);
-                // not duplicated instruction
-                if (this->countInstructions(instruction) != 0)
-                {
-                    unsigned instructionIndex = this->getIndexFromInstr(instruction);
-                    set<unsigned> RVPointToSet = infoIn->pointerMap[instructionIndex];
-                    if (RVPointToSet.size() != 0)
-                    {
-                        // add RVPointToSet into pointerMap of this instruction
-                        infoIn->pointerMap[index].insert(RVPointToSet.begin(), RVPointToSet.end());
-                    }
-                }
-            }
+    struct MayPointToAnalysisPass : public FunctionPass
+    {
+        static char ID;
 
-            /*  load
-                out = in U {Ri->Y | Rp -> X and X -> Y} 
-                where Rp is the DFA identifier of <pointer>.*/
-            if (opName == "load")
-            {
-                if (I->getType()->isPointerTy())
-                {
-                    Instruction *instruction = (Instruction *)I->getOperand(0);
-                   
-                    if (this->countInstructions(instruction) != 0)
-                    {
-                        unsigned Y = this->getIndexFromInstr(instruction);
-                        
-                        for (auto X : infoIn->pointerMap[Y])
-                        {
-                            set<unsigned> RPPointToSet = infoIn->pointerMap[X];
-                            if (RPPointToSet.size() != 0)
-                            {
-                                // add RPPointToSet into pointerMap of this instruction
-                                infoIn->pointerMap[index].insert(RPPointToSet.begin(), RPPointToSet.end());
-                            }
-                        }
-                    }
-                }
-            }
+        PointsToSummaries summaries;
+        PointsToSetTable pointsToSets;
 
-            /*  store
-                out = in U {Y->X | Rv -> X and Rp -> Y} 
-                where Rv and Rp are the DFA identifiers of <value> and <pointer>, respectively.*/
-            if (opName == "store")
-            {
-                Instruction *VInstr = (Instruction *)I->getOperand(0);
-                Instruction *PInstr = (Instruction *)I->getOperand(1);
-                // no duplicated instruction
-                if (this->countInstructions(VInstr) != 0 && this->countInstructions(PInstr) != 0)
-                {
-                    unsigned VIndex = this->getIndexFromInstr(VInstr);
-                    unsigned PIndex = this->getIndexFromInstr(PInstr);
-                    auto RVPointToSet = infoIn->pointerMap[VIndex];
+        MayPointToAnalysisPass() : FunctionPass(ID) {}
 
-                    if (RVPointToSet.size() != 0)
-                    {
-                        for (auto Y : infoIn->pointerMap[PIndex])
-                        {
-                            // add RVPointToSet into pointerMap of Y
-                            infoIn->pointerMap[Y].insert(RVPointToSet.begin(), RVPointToSet.end());
-                        }
-                    }
-                }
-            }
+        bool doInitialization(Module &M) override
+        {
+            if (Mode == FlowSensitive && Interprocedural)
+                summaries.compute(M, SummaryThreads);
+            return false;
+        }
 
-            /*  select
-                out = in U {Ri->X | R1 -> X } U {Ri->X | R2 -> X }
-                where R1 and R2 are the DFA identifiers of <val1> and <val2>, respectively.*/
-            if (opName == "select")
+        bool runOnFunction(Function &F) override
+        {
+            if (Mode == FlowSensitive)
             {
-                Instruction *operand1 = (Instruction *)I->getOperand(1);
-                Instruction *operand2 = (Instruction *)I->getOperand(2);
-
-                // add both R1PointToSet and R2PointToSet into pointerMap of this instruction
-                if (this->countInstructions(operand1) != 0)
-                {
-                    unsigned operand1_index = this->getIndexFromInstr(operand1);
-                    auto R1PointToSet = infoIn->pointerMap[operand1_index];
-                    if (R1PointToSet.size() != 0)
-                    {
-                        infoIn->pointerMap[index].insert(R1PointToSet.begin(), R1PointToSet.end());
-                    }
-                }
-                if (this->countInstructions(operand2) != 0)
-                {
-                    unsigned operand2_index = this->getIndexFromInstr(operand2);
-                    auto R2PointToSet = infoIn->pointerMap[operand2_index];
-                    if (!R2PointToSet.size() != 0)
-                    {
-                        infoIn->pointerMap[index].insert(R2PointToSet.begin(), R2PointToSet.end());
-                    }
-                }
+                PointsToSetTable::Scope scope(pointsToSets);
+                MayPointToInfo bot;
+                MayPointToAnalysis mpta(bot, bot);
+                if (Interprocedural)
+                    mpta.setSummaries(&summaries);
+                mpta.runWorklistAlgorithm(&F);
+                mpta.print();
             }
-
-            /*  phi
-                out = in U {Ri->X | R0 -> X } U ... U {Ri->X | Rk -> X }
-                where R0 through Rk are the DFA identifiers of <val0> through <valk>, respectively. 
-                This is the flow function for one phi instruction. 
-            */
-            if (opName == "phi")
+            else if (!ModuleScope)
             {
-                //find the ending of phi by finding the first non phi
-                Instruction *firstNonPhi = I->getParent()->getFirstNonPHI();
-                unsigned FirstNonPhiIndex = this->getIndexFromInstr(firstNonPhi);
-                
-                //traverse from first phi to the first nonPhi
-                for (unsigned phiIndex = index; phiIndex < FirstNonPhiIndex; phiIndex++)
-                {
-                    Instruction *instr_phi = this->getInstrFromIndex(phiIndex);
-                
-                    //traverse all the k phi instructions and add all kth phi instruction into pointerMap
-                    for (unsigned k = 0; k < instr_phi->getNumOperands(); k++)
-                    {
-                        Instruction *kthInstruction = (Instruction *)instr_phi->getOperand(k);
-                        //check no duplication                        
-                        if (this->countInstructions(kthInstruction) != 0)
-                        {
-                            unsigned kthIndex = this->getIndexFromInstr(kthInstruction);
-                            auto kPhiPointToSet = infoIn->pointerMap[kthIndex];
-                            if (kPhiPointToSet.size() != 0)
-                            {   
-                                infoIn->pointerMap[index].insert(kPhiPointToSet.begin(), kPhiPointToSet.end());
-                            }
-                        }
-                    }
-                }
+                if (Mode == Steensgaard)
+                    solveAndPrint<SteensgaardSolver>(*F.getParent(), {&F}, false);
+                else
+                    solveAndPrint<AndersenSolver>(*F.getParent(), {&F}, false);
             }
+            return false;
+        }
+
+        // module scope: one solution for all the functions
+        bool doFinalization(Module &M) override
+        {
+            if (Mode == FlowSensitive || !ModuleScope)
+                return false;
 
-            // Step3: Add result to outgoing edges
-            for (unsigned i = 0; i < Infos.size(); i++)
+            vector<Function *> functions;
+            for (Function &F : M)
             {
-                Infos[i]->pointerMap = infoIn->pointerMap;
+                if (!F.isDeclaration())
+                    functions.push_back(&F);
             }
-
-            delete infoIn;
+            if (Mode == Steensgaard)
+                solveAndPrint<SteensgaardSolver>(M, functions, true);
+            else
+                solveAndPrint<AndersenSolver>(M, functions, true);
+            return false;
         }
     };
+}
 
-    struct MayPointToAnalysisPass : public FunctionPass
+char MayPointToAnalysisPass::ID = 0;
+static RegisterPass<MayPointToAnalysisPass> X("cse231-maypointto", "MayPointToAnalysis ",
+                             false /* Only looks at CFG */,
+                             false /* Analysis Pass */);
+
+namespace
+{
+    /*
+        Alias analysis provider: opt -load submission_pt3.so -cse231-maypointto-aa -gvn < input.ll > output.ll
+        The pass is an ExternalAAWrapperPass, so AAResultsWrapperPass finds it and adds the result to the
+        AAResults of every function. The module is solved once, in doInitialization.
+    */
+    struct MayPointToAAWrapperPass : public ExternalAAWrapperPass
     {
-        static char ID;
+        static char ID;     // registration only, the pass reports itself as ExternalAAWrapperPass
 
-        MayPointToAnalysisPass() : FunctionPass(ID) {}
+        PointsToIndex index;
+        unique_ptr<MayPointToAAResult> result;
 
-        bool runOnFunction(Function &F) override
+        MayPointToAAWrapperPass() : ExternalAAWrapperPass()
+        {
+            CB = [this](Pass &, Function &, AAResults &AAR) {
+                if (result)
+                    AAR.addAAResult(*result);
+            };
+        }
+
+        bool doInitialization(Module &M) override
         {
-            MayPointToInfo bot;
-            MayPointToAnalysis mpta(bot, bot);
-            mpta.runWorklistAlgorithm(&F);
-            mpta.print();
+            index.build(M);
+            result.reset(new MayPointToAAResult(index));
             return false;
         }
     };
 }
 
-char MayPointToAnalysisPass::ID = 0;
-static RegisterPass<MayPointToAnalysisPass> X("cse231-maypointto", "MayPointToAnalysis ",
+char MayPointToAAWrapperPass::ID = 0;
+static RegisterPass<MayPointToAAWrapperPass> Y("cse231-maypointto-aa", "MayPointTo Alias Analysis",
                              false /* Only looks at CFG */,
-                             false /* Analysis Pass */);
\ No newline at end of file
+                             true /* Analysis Pass */);
@@ -0,0 +1,485 @@
+/*  May-point-to Analysis
+    The lattice (MayPointToInfo) and the flow functions (MayPointToAnalysis) of the may-point-to analysis.
+    They live in a header so that other analyses (e.g. the memory reaching definitions) can reuse the points-to facts.
+*/
+#ifndef LLVM_TRANSFORMS_MAYPOINTTO_H
+#define LLVM_TRANSFORMS_MAYPOINTTO_H
+
+#include "231DFA.h"
+#include "PointsToSummary.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <set>
+
+namespace llvm
+{
+    /*  Hash-consed points-to sets
+        Many pointers point to exactly the same set of memory objects, and every edge of the DFA CFG
+        carries a copy of the whole map. Each distinct set is therefore stored once in this table and
+        referred to by an ID:
+            - the maps only copy and compare IDs, so equality of two sets is an ID comparison;
+            - the union of two sets is memoized, so repeated joins of the same sets are a hash lookup.
+        ID 0 is the empty set. The index from a set to its ID only holds hashes; the set itself is only in sets.
+        A table is owned by the pass running the analysis, which installs it (emptied) with a Scope around each
+        function; get() is the table installed on the calling thread.
+    */
+    class PointsToSetTable
+    {
+    public:
+        typedef unsigned SetID;
+
+        PointsToSetTable() : sets(1) {}
+
+        static PointsToSetTable &get()
+        {
+            assert(current() && "no PointsToSetTable installed (PointsToSetTable::Scope)");
+            return *current();
+        }
+
+        // installs table, emptied, on this thread until the end of the scope
+        class Scope
+        {
+        public:
+            Scope(PointsToSetTable &table) : previous(current())
+            {
+                table.clear();
+                current() = &table;
+            }
+            ~Scope() { current() = previous; }
+
+        private:
+            PointsToSetTable *previous;
+        };
+
+        void clear()
+        {
+            sets.assign(1, vector<unsigned>());
+            ids.clear();
+            unions.clear();
+        }
+
+        // objects of a set, sorted; the reference stays valid while new sets are interned
+        const vector<unsigned> &objects(SetID id) const
+        {
+            return sets[id];
+        }
+
+        SetID singleton(unsigned object)
+        {
+            return intern(vector<unsigned>(1, object));
+        }
+
+        SetID unite(SetID a, SetID b)
+        {
+            if (a == b || b == 0)
+                return a;
+            if (a == 0)
+                return b;
+            if (a > b)
+                swap(a, b);
+
+            auto it = unions.find(make_pair(a, b));
+            if (it != unions.end())
+                return it->second;
+
+            vector<unsigned> merged;
+            merged.reserve(sets[a].size() + sets[b].size());
+            set_union(sets[a].begin(), sets[a].end(), sets[b].begin(), sets[b].end(), back_inserter(merged));
+            SetID id = intern(merged);
+            unions[make_pair(a, b)] = id;
+            return id;
+        }
+
+        SetID intern(const vector<unsigned> &sortedObjects)
+        {
+            if (sortedObjects.empty())
+                return 0;
+            size_t hash = hash_combine_range(sortedObjects.begin(), sortedObjects.end());
+            auto range = ids.equal_range(hash);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                if (sets[it->second] == sortedObjects)
+                    return it->second;
+            }
+
+            SetID id = sets.size();
+            sets.push_back(sortedObjects);
+            ids.insert(make_pair(hash, id));
+            return id;
+        }
+
+    private:
+        deque<vector<unsigned>> sets;   // deque: references to the sets survive push_back
+        unordered_multimap<size_t, SetID> ids;
+        DenseMap<pair<SetID, SetID>, SetID> unions;
+
+        static PointsToSetTable *&current()
+        {
+            static thread_local PointsToSetTable *table = nullptr;
+            return table;
+        }
+    };
+
+    class MayPointToInfo : public Info
+    {
+    public:
+        /*  Let Pointers be the set of the DFA identifiers of the pointers in the function (including IR pointers and memory pointers) 
+            and MemoryObjects the set of the DFA identifiers of the memory objects allocated in the function. 
+            The domain D for this analysis is Powerset(S), where S={p → o | p ∊ Pointers && o ∊ MemoryObjects}. 
+
+            IR pointers (registers) and memory objects are two separate index ranges, both identified by the DFA index
+            of the defining (allocating) instruction: pointerMap holds the registers, memoryMap the pointers stored in
+            memory objects. A memory object is therefore never confused with a register, whatever the function size.
+            The sets are IDs of hash-consed sets (see PointsToSetTable), 0 being the empty set.
+            Both maps are sparse with an implicit bottom: a missing key is the empty set and add() never stores one,
+            so an edge only holds the pointers that point somewhere and two equal infos have equal maps.
+        */
+        typedef PointsToSetTable::SetID PointsToSet;
+
+        map<unsigned, PointsToSet> pointerMap;  // Ri -> {Mj}
+        map<unsigned, PointsToSet> memoryMap;   // Mi -> {Mj}
+
+        MayPointToInfo() : Info() {}
+
+        MayPointToInfo(const MayPointToInfo &other) : Info(other)
+        {
+            pointerMap = other.pointerMap;
+            memoryMap = other.memoryMap;
+        }
+
+        ~MayPointToInfo() {}
+
+        // points-to set of key in m, empty if absent (never inserts)
+        static PointsToSet lookup(const map<unsigned, PointsToSet> &m, unsigned key)
+        {
+            auto it = m.find(key);
+            return it == m.end() ? 0 : it->second;
+        }
+
+        // m[key] = m[key] U pointees, without creating empty entries
+        static void add(map<unsigned, PointsToSet> &m, unsigned key, PointsToSet pointees)
+        {
+            if (pointees != 0)
+            {
+                PointsToSet &entry = m[key];
+                entry = unite(entry, pointees);
+            }
+        }
+
+        static PointsToSet unite(PointsToSet a, PointsToSet b)
+        {
+            return PointsToSetTable::get().unite(a, b);
+        }
+
+        static const vector<unsigned> &objects(PointsToSet id)
+        {
+            return PointsToSetTable::get().objects(id);
+        }
+
+        /*
+            The output should be in the following form:
+                Edge[space][src]->Edge[space][dst]:[point-to 1]|[point-to 2]| ... [point-to K]|
+            Registers come first (R[index]->(...)), then the memory objects (M[index]->(...)).
+
+            EX
+            opt -load  submission_pt3.so  -cse231-maypointto </tests/test-example/test1.ll>   /dev/null
+            Edge 0->Edge 1:
+            Edge 1->Edge 2:R1->(M1/)|
+            Edge 2->Edge 3:R1->(M1/)|R2->(M2/)|
+            Edge 3->Edge 4:R1->(M1/)|R2->(M2/)|
+            Edge 4->Edge 5:R1->(M1/)|R2->(M2/)|
+            Edge 5->Edge 6:R1->(M1/)|R2->(M2/)|
+            Edge 6->Edge 7:R1->(M1/)|R2->(M2/)|
+            Edge 7->Edge 8:R1->(M1/)|R2->(M2/)|
+            Edge 7->Edge 12:R1->(M1/)|R2->(M2/)|
+            Edge 8->Edge 9:R1->(M1/)|R2->(M2/)|
+            Edge 9->Edge 10:R1->(M1/)|R2->(M2/)|
+            Edge 10->Edge 11:R1->(M1/)|R2->(M2/)|
+            Edge 11->Edge 16:R1->(M1/)|R2->(M2/)|
+            Edge 12->Edge 13:R1->(M1/)|R2->(M2/)|
+            Edge 13->Edge 14:R1->(M1/)|R2->(M2/)|
+            Edge 14->Edge 15:R1->(M1/)|R2->(M2/)|
+            Edge 15->Edge 16:R1->(M1/)|R2->(M2/)|
+            Edge 16->Edge 17:R1->(M1/)|R2->(M2/)|
+            Edge 17->Edge 18:R1->(M1/)|R2->(M2/)|
+            Edge 18->Edge 19:R1->(M1/)|R2->(M2/)|
+        */
+        void print()
+        {
+            printMap("R", pointerMap);
+            printMap("M", memoryMap);
+			errs() << "\n";
+        }
+
+        static void printMap(const char *prefix, const map<unsigned, PointsToSet> &m)
+        {
+            for (auto const &entry: m) {
+				if (entry.second == 0)
+					continue;
+
+				errs() << prefix << entry.first << "->(";
+
+				for (auto mi : objects(entry.second)) {
+					errs() << "M" << mi << "/";
+				}
+				errs() << ")|";
+			}
+        }
+
+        static bool equals(MayPointToInfo *info1, MayPointToInfo *info2)
+        {
+            return info1->pointerMap == info2->pointerMap && info1->memoryMap == info2->memoryMap;
+        }
+
+        static void *join(MayPointToInfo *info1, MayPointToInfo *info2, MayPointToInfo *result)
+        {
+            if (result != info1)
+            {
+                result->pointerMap = info1->pointerMap;
+                result->memoryMap = info1->memoryMap;
+            }
+            for (auto const &entry : info2->pointerMap)
+            {
+                add(result->pointerMap, entry.first, entry.second);
+            }
+            for (auto const &entry : info2->memoryMap)
+            {
+                add(result->memoryMap, entry.first, entry.second);
+            }
+            return nullptr;
+        }
+    };
+
+    class MayPointToAnalysis : public DataFlowAnalysis<MayPointToInfo, true>
+    {
+    public:
+        MayPointToAnalysis(MayPointToInfo &bottom, MayPointToInfo &initialState) : 
+        DataFlowAnalysis<MayPointToInfo, true>::DataFlowAnalysis(bottom, initialState), summaries(nullptr) {}
+
+        ~MayPointToAnalysis() {}
+
+        // with summaries, calls apply the summary of their callee instead of being ignored
+        void setSummaries(const PointsToSummaries *s)
+        {
+            summaries = s;
+        }
+
+        void flowfunction(Instruction *I,
+                        std::vector<unsigned> &IncomingEdges,
+                        std::vector<unsigned> &OutgoingEdges,
+                        std::vector<MayPointToInfo *> &Infos)
+        {
+            auto *infoIn = new MayPointToInfo();
+            unsigned index = this->getIndexFromInstr(I);
+            
+            // Step 1: merge all incoming edges with the join operation.
+            for (auto start : IncomingEdges)
+            {
+                auto edge = make_pair(start, index);
+                MayPointToInfo::join(infoIn, this->getInfoFromEdge(edge), infoIn);
+            }
+
+            // Step 2: identify the opcode name 
+            string opName(I->getOpcodeName());
+
+            /*  alloca
+                out = in U {Ri->Mi} */
+            if (opName == "alloca")
+            {
+                // the memory object allocated by the instruction has the same index as the register
+                MayPointToInfo::add(infoIn->pointerMap, index, PointsToSetTable::get().singleton(index));
+            }
+
+            /*  bitcast OR  getelementptr
+                out = in U {Ri->X | Rv -> X } 
+                where Rv is the DFA identifier of <value>.  */
+            if (opName == "bitcast" || opName == "getelementptr")
+            {
+                Instruction *instruction = (Instruction *)I->getOperand(0);
+                // not duplicated instruction
+                if (this->countInstructions(instruction) != 0)
+                {
+                    unsigned instructionIndex = this->getIndexFromInstr(instruction);
+                    MayPointToInfo::PointsToSet RVPointToSet = MayPointToInfo::lookup(infoIn->pointerMap, instructionIndex);
+                    // add RVPointToSet into pointerMap of this instruction
+                    MayPointToInfo::add(infoIn->pointerMap, index, RVPointToSet);
+                }
+            }
+
+            /*  load
+                out = in U {Ri->Y | Rp -> X and X -> Y} 
+                where Rp is the DFA identifier of <pointer>.*/
+            if (opName == "load")
+            {
+                if (I->getType()->isPointerTy())
+                {
+                    Instruction *instruction = (Instruction *)I->getOperand(0);
+                   
+                    if (this->countInstructions(instruction) != 0)
+                    {
+                        unsigned Y = this->getIndexFromInstr(instruction);
+                        
+                        MayPointToInfo::PointsToSet RPPointToSet = 0;
+                        for (auto X : MayPointToInfo::objects(MayPointToInfo::lookup(infoIn->pointerMap, Y)))
+                        {
+                            RPPointToSet = MayPointToInfo::unite(RPPointToSet, MayPointToInfo::lookup(infoIn->memoryMap, X));
+                        }
+                        // add RPPointToSet into pointerMap of this instruction
+                        MayPointToInfo::add(infoIn->pointerMap, index, RPPointToSet);
+                    }
+                }
+            }
+
+            /*  store
+                out = in U {Y->X | Rv -> X and Rp -> Y} 
+                where Rv and Rp are the DFA identifiers of <value> and <pointer>, respectively.*/
+            if (opName == "store")
+            {
+                Instruction *VInstr = (Instruction *)I->getOperand(0);
+                Instruction *PInstr = (Instruction *)I->getOperand(1);
+                // no duplicated instruction
+                if (this->countInstructions(VInstr) != 0 && this->countInstructions(PInstr) != 0)
+                {
+                    unsigned VIndex = this->getIndexFromInstr(VInstr);
+                    unsigned PIndex = this->getIndexFromInstr(PInstr);
+                    MayPointToInfo::PointsToSet RVPointToSet = MayPointToInfo::lookup(infoIn->pointerMap, VIndex);
+
+                    if (RVPointToSet != 0)
+                    {
+                        for (auto Y : MayPointToInfo::objects(MayPointToInfo::lookup(infoIn->pointerMap, PIndex)))
+                        {
+                            // add RVPointToSet into memoryMap of Y
+                            MayPointToInfo::add(infoIn->memoryMap, Y, RVPointToSet);
+                        }
+                    }
+                }
+            }
+
+            /*  select
+                out = in U {Ri->X | R1 -> X } U {Ri->X | R2 -> X }
+                where R1 and R2 are the DFA identifiers of <val1> and <val2>, respectively.*/
+            if (opName == "select")
+            {
+                Instruction *operand1 = (Instruction *)I->getOperand(1);
+                Instruction *operand2 = (Instruction *)I->getOperand(2);
+
+                // add both R1PointToSet and R2PointToSet into pointerMap of this instruction
+                if (this->countInstructions(operand1) != 0)
+                {
+                    unsigned operand1_index = this->getIndexFromInstr(operand1);
+                    MayPointToInfo::PointsToSet R1PointToSet = MayPointToInfo::lookup(infoIn->pointerMap, operand1_index);
+                    MayPointToInfo::add(infoIn->pointerMap, index, R1PointToSet);
+                }
+                if (this->countInstructions(operand2) != 0)
+                {
+                    unsigned operand2_index = this->getIndexFromInstr(operand2);
+                    MayPointToInfo::PointsToSet R2PointToSet = MayPointToInfo::lookup(infoIn->pointerMap, operand2_index);
+                    MayPointToInfo::add(infoIn->pointerMap, index, R2PointToSet);
+                }
+            }
+
+            /*  phi
+                out = in U {Ri->X | R0 -> X } U ... U {Ri->X | Rk -> X }
+                where R0 through Rk are the DFA identifiers of <val0> through <valk>, respectively. 
+                This is the flow function for one phi instruction. 
+            */
+            if (opName == "phi")
+            {
+                //find the ending of phi by finding the first non phi
+                Instruction *firstNonPhi = I->getParent()->getFirstNonPHI();
+                unsigned FirstNonPhiIndex = this->getIndexFromInstr(firstNonPhi);
+                
+                //traverse from first phi to the first nonPhi
+                for (unsigned phiIndex = index; phiIndex < FirstNonPhiIndex; phiIndex++)
+                {
+                    Instruction *instr_phi = this->getInstrFromIndex(phiIndex);
+                
+                    //traverse all the k phi instructions and add all kth phi instruction into pointerMap
+                    for (unsigned k = 0; k < instr_phi->getNumOperands(); k++)
+                    {
+                        Instruction *kthInstruction = (Instruction *)instr_phi->getOperand(k);
+                        //check no duplication                        
+                        if (this->countInstructions(kthInstruction) != 0)
+                        {
+                            unsigned kthIndex = this->getIndexFromInstr(kthInstruction);
+                            MayPointToInfo::PointsToSet kPhiPointToSet = MayPointToInfo::lookup(infoIn->pointerMap, kthIndex);
+                            MayPointToInfo::add(infoIn->pointerMap, index, kPhiPointToSet);
+                        }
+                    }
+                }
+            }
+
+            /*  call
+                out = in U {Ri->X | X in source of a return of the callee}
+                         U {Y->X | Y in target and X in source of a store of the callee}
+                using the summary of the callee (interprocedural mode only). */
+            if (opName == "call" && summaries)
+            {
+                applySummary((CallInst *)I, index, infoIn);
+            }
+
+            // Step3: Add result to outgoing edges
+            for (unsigned i = 0; i < Infos.size(); i++)
+            {
+                Infos[i]->pointerMap = infoIn->pointerMap;
+                Infos[i]->memoryMap = infoIn->memoryMap;
+            }
+
+            delete infoIn;
+        }
+
+    private:
+        const PointsToSummaries *summaries;
+
+        void applySummary(CallInst *call, unsigned index, MayPointToInfo *info)
+        {
+            const PointsToSummary *summary = summaries->get(call->getCalledFunction());
+            if (!summary)
+                return;
+
+            // every effect is computed from the state before the call
+            MayPointToInfo before(*info);
+            auto objectsOf = [&](unsigned code) -> MayPointToInfo::PointsToSet {
+                unsigned argNo = PointsToSummary::param(code);
+                if (argNo >= call->arg_size())
+                    return 0;
+                Instruction *arg = dyn_cast<Instruction>(call->getArgOperand(argNo));
+                if (!arg || this->countInstructions(arg) == 0)
+                    return 0;
+
+                MayPointToInfo::PointsToSet pointees = MayPointToInfo::lookup(before.pointerMap, this->getIndexFromInstr(arg));
+                if (!PointsToSummary::deref(code))
+                    return pointees;
+
+                MayPointToInfo::PointsToSet derefPointees = 0;
+                for (auto X : MayPointToInfo::objects(pointees))
+                {
+                    derefPointees = MayPointToInfo::unite(derefPointees, MayPointToInfo::lookup(before.memoryMap, X));
+                }
+                return derefPointees;
+            };
+
+            for (unsigned source : summary->returns)
+            {
+                MayPointToInfo::add(info->pointerMap, index, objectsOf(source));
+            }
+            for (auto const &store : summary->stores)
+            {
+                MayPointToInfo::PointsToSet stored = objectsOf(store.second);
+                for (auto Y : MayPointToInfo::objects(objectsOf(store.first)))
+                {
+                    MayPointToInfo::add(info->memoryMap, Y, stored);
+                }
+            }
+        }
+    };
+}
+#endif // End LLVM_TRANSFORMS_MAYPOINTTO_H
@@ -0,0 +1,170 @@
+/*  Cross-module MOD/MPT Summaries
+    The MOD sets of ConstPropAnalysis only see the functions of one module: a call to a function defined in
+    another module is a call to a declaration. A summary records, for every function a module exports, what a
+    caller in another module needs to know, by name:
+
+        mpt <global>            the address of the external global is taken (MPT) in the module
+        func <name> [star] [unknown]
+        mod <global>            an external global the function (or a function it reaches in its module) may modify
+        call <name>             a declaration it reaches that may write memory, defined in another module or nowhere
+
+        star        it stores through a pointer loaded from memory (the MPT globals may be modified)
+        unknown     it writes memory the MOD sets do not name (stores through other pointers, atomics, indirect calls)
+
+    Each module writes its own summary; merging the summaries of all the modules resolves the calls between them
+    (the MOD set, star and unknown of a function include those of every function it calls, across modules),
+    without loading any IR. The calls left are to functions no module defines, which are then unknown.
+    The merged summary is read back by each module's ConstPropAnalysis, where the declarations it describes get
+    their MOD sets from it.
+*/
+#ifndef LLVM_TRANSFORMS_MODSUMMARY_H
+#define LLVM_TRANSFORMS_MODSUMMARY_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <map>
+#include <set>
+#include <string>
+
+using namespace std;
+
+namespace llvm {
+
+struct FunctionModSummary {
+    set<string> mod;
+    set<string> calls;
+    bool star = false;
+    bool unknown = false;
+
+    // returns true if other added anything
+    bool merge(const FunctionModSummary & other) {
+        size_t before = mod.size() + calls.size();
+        bool flags = (other.star && !star) || (other.unknown && !unknown);
+        mod.insert(other.mod.begin(), other.mod.end());
+        calls.insert(other.calls.begin(), other.calls.end());
+        star |= other.star;
+        unknown |= other.unknown;
+        return flags || mod.size() + calls.size() != before;
+    }
+};
+
+class ModSummary {
+  public:
+    map<string, FunctionModSummary> functions;
+    set<string> mpt;
+
+    bool empty() const { return functions.empty() && mpt.empty(); }
+
+    const FunctionModSummary * get(StringRef name) const {
+        auto it = functions.find(name.str());
+        return it == functions.end() ? nullptr : &it->second;
+    }
+
+    /*
+     * Read a summary written by write(). Returns false and sets error if the file cannot be read or is malformed;
+     * the summaries read before are kept.
+     */
+    bool read(StringRef path, string & error) {
+        ErrorOr<unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(path);
+        if (!buffer) {
+            error = path.str() + ": " + buffer.getError().message();
+            return false;
+        }
+
+        FunctionModSummary * current = nullptr;
+        for (line_iterator line(**buffer, true, ';'); !line.is_at_end(); ++line) {
+            pair<StringRef, StringRef> record = line->trim().split(' ');
+            StringRef rest = record.second.trim();
+            if (record.first == "func") {
+                pair<StringRef, StringRef> name = rest.split(' ');
+                current = &functions[name.first.str()];
+                for (StringRef flags = name.second; !flags.empty(); ) {
+                    pair<StringRef, StringRef> flag = flags.trim().split(' ');
+                    current->star |= flag.first == "star";
+                    current->unknown |= flag.first == "unknown";
+                    flags = flag.second;
+                }
+            }
+            else if (record.first == "mpt") {
+                mpt.insert(rest.str());
+            }
+            else if ((record.first == "mod" || record.first == "call") && current) {
+                (record.first == "mod" ? current->mod : current->calls).insert(rest.str());
+            }
+            else {
+                error = path.str() + ":" + to_string(line.line_number()) + ": unexpected '" + line->str() + "'";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool write(StringRef path, string & error) const {
+        std::error_code EC;
+        raw_fd_ostream out(path, EC);
+        if (EC) {
+            error = path.str() + ": " + EC.message();
+            return false;
+        }
+        print(out);
+        return true;
+    }
+
+    void print(raw_ostream & out) const {
+        out << "; cse231 MOD/MPT summary\n";
+        for (const string & global : mpt)
+            out << "mpt " << global << "\n";
+        for (auto const & function : functions) {
+            out << "func " << function.first;
+            if (function.second.star)
+                out << " star";
+            if (function.second.unknown)
+                out << " unknown";
+            out << "\n";
+            for (const string & global : function.second.mod)
+                out << "mod " << global << "\n";
+            for (const string & callee : function.second.calls)
+                out << "call " << callee << "\n";
+        }
+    }
+
+    // add the summary of another module (a function defined in several modules, e.g. linkonce, gets the union)
+    void add(const ModSummary & other) {
+        mpt.insert(other.mpt.begin(), other.mpt.end());
+        for (auto const & function : other.functions)
+            functions[function.first].merge(function.second);
+    }
+
+    /*
+     * Resolve the calls between the summarized functions: every function gets the MOD set and flags of the
+     * functions it calls, until nothing changes. The calls to functions without a summary are kept and make
+     * the caller unknown; the resolved ones are dropped.
+     */
+    void resolve() {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto & function : functions) {
+                for (const string & callee : set<string>(function.second.calls)) {
+                    auto it = functions.find(callee);
+                    if (it != functions.end() && &it->second != &function.second)
+                        changed |= function.second.merge(it->second);
+                }
+            }
+        }
+        for (auto & function : functions) {
+            set<string> unresolved;
+            for (const string & callee : function.second.calls) {
+                if (functions.count(callee) == 0)
+                    unresolved.insert(callee);
+            }
+            function.second.unknown |= !unresolved.empty();
+            function.second.calls = unresolved;
+        }
+    }
+};
+
+}
+#endif // End LLVM_TRANSFORMS_MODSUMMARY_H
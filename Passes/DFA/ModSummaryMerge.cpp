@@ -0,0 +1,43 @@
+/*  cse231-mod-merge
+    The link step of the cross-module MOD/MPT analysis: merges the summaries written by
+    opt -cse231-constprop -cse231-constprop-write-summary=<file> for every module of a program,
+    resolves the calls between their functions, and writes the summary each module is then analyzed with
+    (opt -cse231-constprop -cse231-constprop-summary=<file>). Only the summaries are read, no IR.
+
+    cse231-mod-merge a.modsum b.modsum ... -o merged.modsum
+*/
+#include "ModSummary.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+
+using namespace llvm;
+using namespace std;
+
+static cl::list<string> Inputs(cl::Positional, cl::desc("<summary files>"), cl::OneOrMore);
+
+static cl::opt<string> Output("o", cl::desc("Merged summary file (stdout if not given)"),
+    cl::value_desc("filename"), cl::init("-"));
+
+int main(int argc, char ** argv) {
+    cl::ParseCommandLineOptions(argc, argv, "cse231 MOD/MPT summary merge\n");
+
+    ModSummary merged;
+    for (const string & input : Inputs) {
+        ModSummary summary;
+        string error;
+        if (!summary.read(input, error)) {
+            errs() << argv[0] << ": " << error << "\n";
+            return 1;
+        }
+        merged.add(summary);
+    }
+    merged.resolve();
+
+    string error;
+    if (!merged.write(Output, error)) {
+        errs() << argv[0] << ": " << error << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,248 @@
+/*  Interprocedural May-point-to Summaries
+    A summary describes what a call to a function does to the pointers of its caller,
+    in terms of the parameters only, so that call sites can apply it without re-analyzing the callee.
+
+    A source (or target) is encoded as 2 * [parameter number] + [deref]:
+        deref = 0   the objects the parameter points to            (P)
+        deref = 1   the objects the pointers stored in P point to   (*P)
+    returns         the return value may point to the source
+    stores          (target, source): the pointers stored in the objects of target may point to the source
+
+    Summaries are computed bottom-up over the SCCs of the call graph (callees first).
+    Each function is solved with the flow-insensitive AndersenSolver, with two placeholder objects per parameter
+    standing for P and *P; calls to functions already summarized are replaced by their summaries.
+    Functions of an SCC are iterated until their summaries are stable (recursion).
+    The SCCs are grouped by level (1 + the highest level of their callees); the SCCs of a level only depend on
+    lower levels, so they can be summarized by several threads.
+
+    Effects through globals, deeper than two levels of indirection, or on the callee's own allocas are not described.
+*/
+#ifndef LLVM_TRANSFORMS_POINTSTOSUMMARY_H
+#define LLVM_TRANSFORMS_POINTSTOSUMMARY_H
+
+#include "FlowInsensitivePointsTo.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/IR/Module.h"
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace llvm {
+
+struct PointsToSummary {
+    set<unsigned> returns;
+    set<pair<unsigned, unsigned>> stores;
+
+    static unsigned source(unsigned param, bool deref) { return 2 * param + (deref ? 1 : 0); }
+    static unsigned param(unsigned source) { return source / 2; }
+    static bool deref(unsigned source) { return source % 2 == 1; }
+
+    bool operator==(const PointsToSummary & other) const {
+        return returns == other.returns && stores == other.stores;
+    }
+    bool operator!=(const PointsToSummary & other) const { return !(*this == other); }
+};
+
+class PointsToSummaries {
+  public:
+    /*
+     * Summarize every function defined in M.
+     * threads > 1 summarizes the SCCs of a level in parallel.
+     */
+    void compute(Module & M, unsigned threads) {
+        CallGraph CG(M);
+
+        // SCCs bottom-up, and their levels
+        vector<vector<Function *>> sccs;
+        map<Function *, unsigned> sccOf;
+        vector<unsigned> levels;
+        unsigned maxLevel = 0;
+        for (scc_iterator<CallGraph *> it = scc_begin(&CG); !it.isAtEnd(); ++it) {
+            vector<Function *> scc;
+            for (CallGraphNode * node : *it) {
+                Function * F = node->getFunction();
+                if (F && !F->isDeclaration())
+                    scc.push_back(F);
+            }
+            if (scc.empty())
+                continue;
+
+            unsigned id = sccs.size();
+            unsigned level = 0;
+            for (CallGraphNode * node : *it) {
+                for (auto const & record : *node) {
+                    Function * callee = record.second->getFunction();
+                    if (callee && sccOf.count(callee) != 0 && sccOf[callee] != id)
+                        level = std::max(level, levels[sccOf[callee]] + 1);
+                }
+            }
+            for (Function * F : scc) {
+                sccOf[F] = id;
+                summaries[F];   // every summary exists before any thread starts
+            }
+            sccs.push_back(scc);
+            levels.push_back(level);
+            maxLevel = std::max(maxLevel, level);
+        }
+
+        vector<vector<unsigned>> byLevel(maxLevel + 1);
+        for (unsigned id = 0; id < sccs.size(); id++)
+            byLevel[levels[id]].push_back(id);
+
+        for (auto const & level : byLevel) {
+            unsigned workers = std::min<unsigned>(std::max<unsigned>(threads, 1), level.size());
+            if (workers <= 1) {
+                for (unsigned id : level)
+                    summarizeSCC(sccs[id]);
+                continue;
+            }
+
+            atomic<unsigned> next(0);
+            vector<thread> pool;
+            for (unsigned w = 0; w < workers; w++) {
+                pool.push_back(thread([&]() {
+                    for (unsigned i = next++; i < level.size(); i = next++)
+                        summarizeSCC(sccs[level[i]]);
+                }));
+            }
+            for (thread & t : pool)
+                t.join();
+        }
+    }
+
+    // nullptr for functions without a summary (declarations, indirect calls)
+    const PointsToSummary * get(Function * F) const {
+        auto it = summaries.find(F);
+        return it == summaries.end() ? nullptr : &it->second;
+    }
+
+  private:
+    map<Function *, PointsToSummary> summaries;
+    mutex lock;     // guards the summaries of the SCC being iterated against readers of other levels
+
+    void summarizeSCC(const vector<Function *> & scc) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (Function * F : scc) {
+                PointsToSummary summary = summarize(*F);
+                lock_guard<mutex> guard(lock);
+                if (summary != summaries[F]) {
+                    summaries[F] = summary;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    PointsToSummary summarize(Function & F) {
+        PointsToConstraints C;
+
+        // placeholder objects P and *P of every pointer parameter
+        vector<pair<unsigned, unsigned>> placeholders;   // node -> source code
+        for (Argument & arg : F.args()) {
+            if (!arg.getType()->isPointerTy())
+                continue;
+            unsigned P = C.addNode(true);
+            unsigned derefP = C.addNode(true);
+            C.addConstraint(PointsToConstraints::AddressOf, C.getValueNode(&arg), P);
+            C.addConstraint(PointsToConstraints::AddressOf, P, derefP);
+            placeholders.push_back(make_pair(P, PointsToSummary::source(arg.getArgNo(), false)));
+            placeholders.push_back(make_pair(derefP, PointsToSummary::source(arg.getArgNo(), true)));
+        }
+
+        C.addFunction(F, false);
+
+        unsigned returnNode = C.addNode(false);
+        for (inst_iterator it = inst_begin(F), E = inst_end(F); it != E; ++it) {
+            if (ReturnInst * ret = dyn_cast<ReturnInst>(&*it)) {
+                if (ret->getReturnValue() && C.hasNode(ret->getReturnValue()))
+                    C.addConstraint(PointsToConstraints::Copy, returnNode, C.getValueNode(ret->getReturnValue()));
+            }
+            if (CallInst * call = dyn_cast<CallInst>(&*it))
+                applyToConstraints(call, C);
+        }
+
+        AndersenSolver solver;
+        solver.solve(C);
+
+        map<unsigned, unsigned> sourceOf(placeholders.begin(), placeholders.end());
+        PointsToSummary summary;
+
+        vector<unsigned> objects;
+        solver.getPointsTo(returnNode, objects);
+        for (unsigned o : objects) {
+            if (sourceOf.count(o) != 0)
+                summary.returns.insert(sourceOf[o]);
+        }
+
+        for (auto const & target : placeholders) {
+            objects.clear();
+            solver.getPointsTo(target.first, objects);
+            for (unsigned o : objects) {
+                if (sourceOf.count(o) == 0)
+                    continue;
+                // P initially points to *P: that is the caller's state, not an effect of the call
+                if (PointsToSummary::deref(sourceOf[o]) && sourceOf[o] == target.second + 1)
+                    continue;
+                summary.stores.insert(make_pair(target.second, sourceOf[o]));
+            }
+        }
+        return summary;
+    }
+
+    // the summary of the callee of call, as constraints of the function being summarized
+    void applyToConstraints(CallInst * call, PointsToConstraints & C) {
+        Function * callee = call->getCalledFunction();
+        if (!callee)
+            return;
+
+        PointsToSummary summary;
+        {
+            lock_guard<mutex> guard(lock);
+            auto it = summaries.find(callee);
+            if (it == summaries.end())
+                return;
+            summary = it->second;
+        }
+
+        auto node = [&](unsigned code, bool & ok) -> unsigned {
+            unsigned argNo = PointsToSummary::param(code);
+            ok = argNo < call->arg_size() && C.hasNode(call->getArgOperand(argNo));
+            if (!ok)
+                return 0;
+            unsigned argNode = C.getValueNode(call->getArgOperand(argNo));
+            if (!PointsToSummary::deref(code))
+                return argNode;
+            unsigned loaded = C.addNode(false);
+            C.addConstraint(PointsToConstraints::Load, loaded, argNode);
+            return loaded;
+        };
+
+        bool ok;
+        for (unsigned source : summary.returns) {
+            unsigned src = node(source, ok);
+            if (ok && call->getType()->isPointerTy())
+                C.addConstraint(PointsToConstraints::Copy, C.getValueNode(call), src);
+        }
+        for (auto const & store : summary.stores) {
+            unsigned dst = node(store.first, ok);
+            if (!ok)
+                continue;
+            unsigned src = node(store.second, ok);
+            if (ok)
+                C.addConstraint(PointsToConstraints::Store, dst, src);
+        }
+    }
+};
+
+}
+#endif // End LLVM_TRANSFORMS_POINTSTOSUMMARY_H
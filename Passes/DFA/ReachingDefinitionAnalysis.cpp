@@ -9,10 +9,20 @@
     Let us call it DFA CFG. Analyses based on 231DFA.h should work on DFA CFGs. 
 */
 #include "231DFA.h"
+#include "MayPointToAnalysis.h"
+#include "llvm/ADT/BitVector.h"
 #include "llvm/Pass.h"
+#include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <memory>
 #include <string>
 #include <vector>
 #include <set>
@@ -20,6 +30,20 @@
 using namespace llvm;
 using namespace std;
 
+// opt -load submission_pt2.so -cse231-reaching -cse231-reaching-chains [-cse231-reaching-chains-out=chains.bin] < input.ll > /dev/null
+static cl::opt<bool> PrintChains("cse231-reaching-chains",
+    cl::desc("Print the use-def and def-use chains built from the reaching definitions instead of the per-edge sets"),
+    cl::init(false));
+
+// opt -load submission_pt2.so -cse231-reaching -cse231-reaching-memory < input.ll > /dev/null
+static cl::opt<bool> MemoryReaching("cse231-reaching-memory",
+    cl::desc("Print the stores (and calls) that reach each program point as definitions of allocas and globals"),
+    cl::init(false));
+
+static cl::opt<string> ChainsOutput("cse231-reaching-chains-out",
+    cl::desc("Write the use-def and def-use chains of every function to this file in binary form"),
+    cl::value_desc("filename"), cl::init(""));
+
 namespace {
     
     /*
@@ -143,14 +167,536 @@ namespace {
             }
 
             //Step3: add the newly computed information into the flow function result called Infos
+            // the framework already allocates one Info per outgoing edge
             for(unsigned i=0; i<OutgoingEdges.size(); i++){
-                Infos.push_back(new Info());
                 Infos[i]->definedInsts = info_in->definedInsts;
             }
             delete info_in;
         }
     };
 
+    /*
+        Memory reaching definitions.
+
+        The locations are the allocas of the function and the globals it references.
+        A definition is a store, or a call that may write memory. It writes
+            - exactly one location (a must-definition) if its pointer is the location itself (up to casts) and it
+              stores as many bytes as the location has; it then kills the definitions that write only that
+              location (a definition that may write other locations still reaches those).
+            - possibly several locations (a may-definition) otherwise; it kills nothing. The locations come from
+              the underlying alloca/global of a getelementptr, or else from the may-point-to facts of the pointer.
+              The may-point-to analysis only tracks allocas, so its facts only describe a pointer built from
+              allocas (see modeled()). Any other pointer (and any call) may write every address-taken alloca and
+              every global.
+
+        Definitions are numbered densely and the solver runs on basic blocks with per-block gen/kill bit-vectors:
+            out[B] = gen[B] U (in[B] - kill[B]),  in[B] = U out[P] for P in pred(B)
+    */
+    class MemoryReachingDefinitions {
+        public:
+            vector<Value *> locations;
+            map<Value *, unsigned> locationIndex;
+            vector<unsigned> defInstr;              // definition -> instruction index
+            map<unsigned, unsigned> instrToDef;     // instruction index -> definition
+            vector<vector<unsigned>> defLocations;  // definition -> locations it may write
+            vector<bool> defIsMust;
+            vector<BitVector> locationDefs;         // location -> definitions that may write it
+            vector<BitVector> locationKills;        // location -> definitions that write it and nothing else
+            map<BasicBlock *, BitVector> in, out;
+
+            MemoryReachingDefinitions(Function & F) : F(F), pointsTo(bot, bot), pointsToSolved(false) {
+                collectLocations();
+
+                for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+                    Instruction * instr = &*I;
+                    vector<unsigned> locs;
+                    bool must = false;
+
+                    if (StoreInst * store = dyn_cast<StoreInst>(instr))
+                        must = resolve(store->getPointerOperand(), store, locs) && overwrites(store, locations[locs[0]]);
+                    else if (isa<CallInst>(instr) && instr->mayWriteToMemory())
+                        locs = addressTaken;
+                    else
+                        continue;
+
+                    unsigned index = indexOf(instr);
+                    instrToDef[index] = defInstr.size();
+                    defInstr.push_back(index);
+                    defLocations.push_back(locs);
+                    defIsMust.push_back(must);
+                }
+
+                locationDefs.assign(locations.size(), BitVector(defInstr.size()));
+                locationKills.assign(locations.size(), BitVector(defInstr.size()));
+                for (unsigned d = 0; d < defInstr.size(); d++) {
+                    for (unsigned loc : defLocations[d])
+                        locationDefs[loc].set(d);
+                    if (defLocations[d].size() == 1)
+                        locationKills[defLocations[d][0]].set(d);
+                }
+            }
+
+            /*
+                Locations a pointer may access, as seen by instruction I.
+                Returns true if the pointer is exactly one location (and points to its start).
+            */
+            bool resolve(Value * ptr, Instruction * I, vector<unsigned> & locs) {
+                Value * base = ptr->stripPointerCasts();
+                if (locationIndex.count(base) != 0) {
+                    locs.push_back(locationIndex[base]);
+                    return true;
+                }
+
+                // an element of an alloca or a global
+                while (true) {
+                    if (GEPOperator * gep = dyn_cast<GEPOperator>(base))
+                        base = gep->getPointerOperand()->stripPointerCasts();
+                    else
+                        break;
+                }
+                if (locationIndex.count(base) != 0) {
+                    locs.push_back(locationIndex[base]);
+                    return false;
+                }
+
+                // an indirect access: ask the may-point-to analysis, if its facts describe the pointer
+                Instruction * ptrInstr = dyn_cast<Instruction>(ptr);
+                if (ptrInstr && isModeled(ptrInstr)) {
+                    set<unsigned> objects;
+                    pointsToAt(I, ptrInstr, objects);
+                    for (unsigned object : objects) {
+                        Instruction * alloca = pointsTo.getInstrFromIndex(object);
+                        if (alloca && locationIndex.count(alloca) != 0)
+                            locs.push_back(locationIndex[alloca]);
+                    }
+                    if (!locs.empty())
+                        return false;
+                }
+
+                locs = addressTaken;
+                return false;
+            }
+
+            // ptr only comes from allocas of F, so its may-point-to facts are complete
+            bool isModeled(Value * ptr) {
+                auto it = modeledPointers.find(ptr);
+                if (it != modeledPointers.end())
+                    return it->second;
+                set<Value *> visiting;
+                return modeledPointers[ptr] = modeled(ptr, visiting);
+            }
+
+            /*
+                The pointers the may-point-to analysis follows: allocas, and bitcasts, getelementptrs, selects and
+                phis of such pointers. A pointer loaded from an alloca is one if the alloca is not address-taken
+                (so its only writes are the stores to it) and every pointer stored to it is one.
+                A pointer met again (a phi cycle) is assumed to be one, the other incoming values decide.
+            */
+            bool modeled(Value * ptr, set<Value *> & visiting) {
+                Instruction * instr = dyn_cast<Instruction>(ptr);
+                if (!instr || instr->getParent()->getParent() != &F)
+                    return false;
+                if (!visiting.insert(instr).second)
+                    return true;
+
+                if (isa<AllocaInst>(instr))
+                    return true;
+                if (isa<BitCastInst>(instr) || isa<GetElementPtrInst>(instr))
+                    return modeled(instr->getOperand(0), visiting);
+                if (SelectInst * select = dyn_cast<SelectInst>(instr))
+                    return modeled(select->getTrueValue(), visiting) && modeled(select->getFalseValue(), visiting);
+                if (PHINode * phi = dyn_cast<PHINode>(instr)) {
+                    for (Value * incoming : phi->incoming_values()) {
+                        if (!modeled(incoming, visiting))
+                            return false;
+                    }
+                    return true;
+                }
+                if (LoadInst * load = dyn_cast<LoadInst>(instr)) {
+                    AllocaInst * slot = dyn_cast<AllocaInst>(load->getPointerOperand());
+                    if (!slot || slot->getParent()->getParent() != &F || isAddressTaken(slot))
+                        return false;
+                    for (User * user : slot->users()) {
+                        StoreInst * store = dyn_cast<StoreInst>(user);
+                        if (store && !modeled(store->getValueOperand(), visiting))
+                            return false;
+                    }
+                    return true;
+                }
+                return false;
+            }
+
+            // the store writes all of location, e.g. not an i8 through a cast of an i32 alloca
+            bool overwrites(StoreInst * store, Value * location) {
+                const DataLayout & DL = F.getParent()->getDataLayout();
+                Type * type;
+                if (AllocaInst * alloca = dyn_cast<AllocaInst>(location)) {
+                    if (alloca->isArrayAllocation())
+                        return false;
+                    type = alloca->getAllocatedType();
+                }
+                else
+                    type = cast<GlobalVariable>(location)->getValueType();
+                if (!type->isSized())
+                    return false;
+                return DL.getTypeStoreSize(store->getValueOperand()->getType()) == DL.getTypeStoreSize(type);
+            }
+
+            /*
+                Solve on basic blocks.
+            */
+            void solve() {
+                unsigned numDefs = defInstr.size();
+                map<BasicBlock *, BitVector> gen, kill;
+
+                for (BasicBlock & B : F) {
+                    BitVector g(numDefs), k(numDefs);
+                    for (Instruction & I : B) {
+                        auto it = instrToDef.find(indexOf(&I));
+                        if (it == instrToDef.end())
+                            continue;
+                        unsigned d = it->second;
+                        if (defIsMust[d]) {
+                            const BitVector & only = locationKills[defLocations[d][0]];
+                            k |= only;
+                            g.reset(only);
+                        }
+                        g.set(d);
+                    }
+                    gen[&B] = g;
+                    kill[&B] = k;
+                    in[&B] = BitVector(numDefs);
+                    out[&B] = g;
+                }
+
+                deque<BasicBlock *> worklist;
+                set<BasicBlock *> queued;
+                for (BasicBlock & B : F) {
+                    worklist.push_back(&B);
+                    queued.insert(&B);
+                }
+
+                while (!worklist.empty()) {
+                    BasicBlock * B = worklist.front();
+                    worklist.pop_front();
+                    queued.erase(B);
+
+                    BitVector & blockIn = in[B];
+                    for (auto pi = pred_begin(B), pe = pred_end(B); pi != pe; ++pi)
+                        blockIn |= out[*pi];
+
+                    BitVector newOut = blockIn;
+                    newOut.reset(kill[B]);
+                    newOut |= gen[B];
+                    if (newOut == out[B])
+                        continue;
+
+                    out[B] = newOut;
+                    for (auto si = succ_begin(B), se = succ_end(B); si != se; ++si) {
+                        if (queued.insert(*si).second)
+                            worklist.push_back(*si);
+                    }
+                }
+            }
+
+            // reaching definitions right after instruction I, given the ones right before it
+            void transfer(Instruction * I, BitVector & reach) {
+                auto it = instrToDef.find(indexOf(I));
+                if (it == instrToDef.end())
+                    return;
+                unsigned d = it->second;
+                if (defIsMust[d])
+                    reach.reset(locationKills[defLocations[d][0]]);
+                reach.set(d);
+            }
+
+            // instruction indices of the definitions that may write one of locs
+            void reachingDefsOf(const BitVector & reach, const vector<unsigned> & locs, set<unsigned> & defs) {
+                for (unsigned loc : locs) {
+                    BitVector both = reach;
+                    both &= locationDefs[loc];
+                    for (int d = both.find_first(); d != -1; d = both.find_next(d))
+                        defs.insert(defInstr[d]);
+                }
+            }
+
+            /*
+                Expand the block solution into the edges of the DFA CFG of an analysis built with initializeMap(),
+                so that print() shows the memory definitions in the usual format.
+            */
+            template <class Analysis>
+            void fillEdges(Analysis & analysis) {
+                for (BasicBlock & B : F) {
+                    BitVector reach = in[&B];
+                    Instruction * firstInstr = &(B.front());
+
+                    if (isa<PHINode>(firstInstr))
+                        setEdge(analysis, firstInstr, B.getFirstNonPHI(), reach);
+
+                    for (Instruction & I : B) {
+                        if (isa<PHINode>(&I))
+                            continue;
+                        transfer(&I, reach);
+                        if (&I == B.getTerminator())
+                            break;
+                        setEdge(analysis, &I, I.getNextNode(), reach);
+                    }
+
+                    for (auto si = succ_begin(&B), se = succ_end(&B); si != se; ++si)
+                        setEdge(analysis, B.getTerminator(), &((*si)->front()), reach);
+                }
+            }
+
+        private:
+            Function & F;
+            vector<unsigned> addressTaken;          // locations that may be written through an unknown pointer
+            MayPointToInfo bot;
+            MayPointToAnalysis pointsTo;
+            bool pointsToSolved;
+            map<unsigned, vector<MayPointToInfo *>> pointsToIn; // instruction index -> incoming may-point-to facts
+            map<Value *, bool> modeledPointers;     // memo of isModeled()
+
+            unsigned indexOf(Instruction * I) {
+                return pointsTo.getIndexFromInstr(I);
+            }
+
+            void collectLocations() {
+                // instruction indices, needed by indexOf() even if the may-point-to facts are never used
+                pointsTo.initializeMap(&F);
+
+                set<GlobalVariable *> globals;
+                for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+                    if (AllocaInst * alloca = dyn_cast<AllocaInst>(&*I)) {
+                        addLocation(alloca);
+                        if (isAddressTaken(alloca))
+                            addressTaken.push_back(locationIndex[alloca]);
+                    }
+                    for (Use & operand : I->operands()) {
+                        if (GlobalVariable * global = dyn_cast<GlobalVariable>(operand->stripPointerCasts()))
+                            globals.insert(global);
+                    }
+                }
+                // globals in module order, so the numbering does not depend on pointer values
+                for (GlobalVariable & global : F.getParent()->globals()) {
+                    if (globals.count(&global) != 0) {
+                        addLocation(&global);
+                        addressTaken.push_back(locationIndex[&global]);
+                    }
+                }
+            }
+
+            void addLocation(Value * location) {
+                locationIndex[location] = locations.size();
+                locations.push_back(location);
+            }
+
+            // an alloca whose address is used other than as the pointer of a load or a store
+            static bool isAddressTaken(AllocaInst * alloca) {
+                for (User * user : alloca->users()) {
+                    if (isa<LoadInst>(user))
+                        continue;
+                    if (StoreInst * store = dyn_cast<StoreInst>(user)) {
+                        if (store->getValueOperand() != alloca)
+                            continue;
+                    }
+                    return true;
+                }
+                return false;
+            }
+
+            void pointsToAt(Instruction * I, Instruction * ptr, set<unsigned> & objects) {
+                if (!pointsToSolved) {
+                    pointsTo.runWorklistAlgorithm(&F);
+                    for (auto const & it : pointsTo.getEdgeToInfo())
+                        pointsToIn[it.first.second].push_back(it.second);
+                    pointsToSolved = true;
+                }
+
+                unsigned ptrIndex = indexOf(ptr);
+                for (MayPointToInfo * info : pointsToIn[indexOf(I)]) {
+                    for (unsigned object : MayPointToInfo::objects(MayPointToInfo::lookup(info->pointerMap, ptrIndex)))
+                        objects.insert(object);
+                }
+            }
+
+            template <class Analysis>
+            void setEdge(Analysis & analysis, Instruction * src, Instruction * dst, const BitVector & reach) {
+                ReachingInfo * info = new ReachingInfo();
+                for (int d = reach.find_first(); d != -1; d = reach.find_next(d))
+                    info->definedInsts.insert(defInstr[d]);
+                analysis.setInfoToEdge(make_pair(analysis.getIndexFromInstr(src), analysis.getIndexFromInstr(dst)), info);
+            }
+    };
+
+    /*
+        Def-use / use-def chains in CSR (compressed sparse row) form.
+
+        Every operand of every instruction is a use. Uses are numbered densely in instruction order:
+            the uses of instruction i are firstUse[i] .. firstUse[i+1]-1, one per operand, so use(i, k) = firstUse[i] + k.
+        The definitions reaching use u are   useDefs[useDefStart[u] .. useDefStart[u+1]-1]  (instruction indices),
+        the uses reached by definition d are defUses[defUseStart[d] .. defUseStart[d+1]-1] (use numbers).
+        Both directions are therefore O(1) to locate and contiguous to scan.
+    */
+    struct ReachingChains {
+        vector<unsigned> firstUse;      // size #instructions + 2, index 0 is the dummy instruction
+        vector<unsigned> useInstr;      // use -> index of the using instruction
+        vector<unsigned> useDefStart;   // size #uses + 1
+        vector<unsigned> useDefs;
+        vector<unsigned> defUseStart;   // size #instructions + 2
+        vector<unsigned> defUses;
+
+        unsigned numInstrs() const { return firstUse.size() - 2; }
+        unsigned numUses() const { return useInstr.size(); }
+        unsigned getUse(unsigned instr, unsigned operand) const { return firstUse[instr] + operand; }
+        unsigned getOperandNo(unsigned use) const { return use - firstUse[useInstr[use]]; }
+
+        /*
+            Build the chains from (use, def) pairs listed in increasing use order.
+            The def-use side is the transpose, computed with a counting sort.
+        */
+        void build(const vector<pair<unsigned, unsigned>> & useDefPairs) {
+            useDefStart.assign(numUses() + 1, 0);
+            defUseStart.assign(numInstrs() + 2, 0);
+            useDefs.clear();
+            useDefs.reserve(useDefPairs.size());
+
+            for (auto const & p : useDefPairs) {
+                useDefStart[p.first + 1]++;
+                defUseStart[p.second + 1]++;
+                useDefs.push_back(p.second);
+            }
+            for (unsigned u = 0; u < numUses(); u++)
+                useDefStart[u + 1] += useDefStart[u];
+            for (unsigned d = 0; d + 1 < defUseStart.size(); d++)
+                defUseStart[d + 1] += defUseStart[d];
+
+            defUses.assign(useDefPairs.size(), 0);
+            vector<unsigned> next(defUseStart.begin(), defUseStart.end() - 1);
+            for (auto const & p : useDefPairs)
+                defUses[next[p.second]++] = p.first;
+        }
+
+        /*
+            Output:
+                UseDef[space][instr].[operand]:[def 1]|[def 2]| ... [def K]|\n
+                DefUse[space][def]:[instr 1].[operand 1]| ... [instr K].[operand K]|\n
+            Uses without reaching definitions and definitions without uses are skipped.
+        */
+        void print() const {
+            for (unsigned u = 0; u < numUses(); u++) {
+                if (useDefStart[u] == useDefStart[u + 1])
+                    continue;
+                errs() << "UseDef " << useInstr[u] << '.' << getOperandNo(u) << ':';
+                for (unsigned i = useDefStart[u]; i < useDefStart[u + 1]; i++)
+                    errs() << useDefs[i] << '|';
+                errs() << "\n";
+            }
+            for (unsigned d = 1; d <= numInstrs(); d++) {
+                if (defUseStart[d] == defUseStart[d + 1])
+                    continue;
+                errs() << "DefUse " << d << ':';
+                for (unsigned i = defUseStart[d]; i < defUseStart[d + 1]; i++)
+                    errs() << useInstr[defUses[i]] << '.' << getOperandNo(defUses[i]) << '|';
+                errs() << "\n";
+            }
+        }
+
+        /*
+            Binary form, all fields little-endian uint32:
+                #instructions, #uses, #use-def pairs,
+                firstUse[#instructions + 2], useDefStart[#uses + 1], useDefs[#pairs],
+                defUseStart[#instructions + 2], defUses[#pairs]
+        */
+        void write(raw_ostream & OS) const {
+            support::endian::Writer W(OS, support::little);
+            W.write<uint32_t>(numInstrs());
+            W.write<uint32_t>(numUses());
+            W.write<uint32_t>(useDefs.size());
+            for (auto const * column : {&firstUse, &useDefStart, &useDefs, &defUseStart, &defUses}) {
+                for (unsigned x : *column)
+                    W.write<uint32_t>(x);
+            }
+        }
+    };
+
+    /*
+        Convert the converged reaching definitions of rda into chains.
+        A definition d reaches the use of operand k of instruction i if operand k is the value defined by d
+        and d is in the reaching set right before i; for a phi the reaching set at the end of the incoming block is used.
+        With memory reaching definitions, the pointer operand of a load is also reached by the stores (and calls)
+        that may write one of the locations the load may read.
+    */
+    template <class Analysis>
+    void buildReachingChains(Function & F, Analysis & rda, ReachingChains & chains,
+                             MemoryReachingDefinitions * memory = nullptr) {
+        unsigned numInstrs = 0;
+        for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
+            numInstrs++;
+
+        // reaching set before each instruction: the join of its incoming edges
+        vector<set<unsigned>> reachIn(numInstrs + 1);
+        for (auto const & it : rda.getEdgeToInfo()) {
+            auto const & defs = it.second->definedInsts;
+            reachIn[it.first.second].insert(defs.begin(), defs.end());
+        }
+
+        chains.firstUse.assign(numInstrs + 2, 0);
+        chains.useInstr.clear();
+        vector<pair<unsigned, unsigned>> useDefPairs;
+
+        // memory definitions reaching the current instruction: each block is walked once from its in set
+        BasicBlock * memoryBlock = nullptr;
+        BitVector memoryReach;
+
+        for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+            Instruction * instr = &*I;
+            unsigned index = rda.getIndexFromInstr(instr);
+            if (memory && instr->getParent() != memoryBlock) {
+                memoryBlock = instr->getParent();
+                memoryReach = memory->in[memoryBlock];
+            }
+            chains.firstUse[index] = chains.useInstr.size();
+
+            for (unsigned k = 0; k < instr->getNumOperands(); k++) {
+                unsigned use = chains.useInstr.size();
+                chains.useInstr.push_back(index);
+
+                Instruction * def = dyn_cast<Instruction>(instr->getOperand(k));
+                if (!def || rda.countInstructions(def) == 0)
+                    continue;
+                unsigned defIndex = rda.getIndexFromInstr(def);
+
+                const set<unsigned> * reach = &reachIn[index];
+                set<unsigned> phiReach;
+                if (PHINode * phi = dyn_cast<PHINode>(instr)) {
+                    // only the first phi of a block has incoming edges in the DFA CFG
+                    unsigned src = rda.getIndexFromInstr((Instruction *)phi->getIncomingBlock(k)->getTerminator());
+                    unsigned dst = rda.getIndexFromInstr(&(phi->getParent()->front()));
+                    phiReach = rda.getInfoFromEdge(make_pair(src, dst))->definedInsts;
+                    reach = &phiReach;
+                }
+                if (reach->count(defIndex) != 0)
+                    useDefPairs.push_back(make_pair(use, defIndex));
+            }
+
+            LoadInst * load = dyn_cast<LoadInst>(instr);
+            if (memory && load) {
+                vector<unsigned> locs;
+                memory->resolve(load->getPointerOperand(), load, locs);
+
+                set<unsigned> memoryDefs;
+                memory->reachingDefsOf(memoryReach, locs, memoryDefs);
+                for (unsigned defIndex : memoryDefs)
+                    useDefPairs.push_back(make_pair(chains.getUse(index, load->getPointerOperandIndex()), defIndex));
+            }
+            if (memory)
+                memory->transfer(instr, memoryReach);
+        }
+        chains.firstUse[numInstrs + 1] = chains.useInstr.size();
+
+        chains.build(useDefPairs);
+    }
+
     /*
         A function pass called ReachingDefinitionAnalysisPass in ReachingDefinitionAnalysis.cpp: 
         This pass should be registered by the name cse231-reaching.
@@ -165,13 +711,86 @@ namespace {
     struct ReachingDefinitionAnalysisPass : public FunctionPass {
         static char ID;
 
+        unique_ptr<raw_fd_ostream> chainsFile;
+        PointsToSetTable pointsToSets;      // the sets of the may-point-to facts of the memory definitions
+
         ReachingDefinitionAnalysisPass() : FunctionPass(ID) {}
 
+        bool doInitialization(Module &M) override {
+            if (!ChainsOutput.empty()) {
+                error_code EC;
+                chainsFile.reset(new raw_fd_ostream(ChainsOutput, EC, sys::fs::OF_None));
+                if (EC) {
+                    errs() << "cannot open " << ChainsOutput << ": " << EC.message() << "\n";
+                    chainsFile.reset();
+                } else {
+                    // file header: magic, version
+                    chainsFile->write("RDCH", 4);
+                    support::endian::Writer(*chainsFile, support::little).write<uint32_t>(1);
+                }
+            }
+            return false;
+        }
+
         bool runOnFunction(Function &F) override {
             ReachingInfo baseInfo;
             ReachingDefinitionAnalysis<ReachingInfo,true> rda(baseInfo, baseInfo);
             rda.runWorklistAlgorithm(&F);   // call method of parent class "DataFlowAnalysis"
-            rda.print();                    // call overriden print()
+
+            if (MemoryReaching)
+                return runOnMemory(F, rda);
+
+            if (!PrintChains && !chainsFile) {
+                rda.print();                // call overriden print()
+                return false;
+            }
+
+            ReachingChains chains;
+            buildReachingChains(F, rda, chains);
+            if (PrintChains)
+                chains.print();
+            else
+                rda.print();
+
+            if (chainsFile)
+                writeChains(F, chains);
+            return false;
+        }
+
+        bool runOnMemory(Function &F, ReachingDefinitionAnalysis<ReachingInfo,true> &rda) {
+            PointsToSetTable::Scope scope(pointsToSets);
+            MemoryReachingDefinitions memory(F);
+            memory.solve();
+
+            ReachingChains chains;
+            if (PrintChains || chainsFile)
+                buildReachingChains(F, rda, chains, &memory);
+
+            if (PrintChains) {
+                chains.print();
+            } else {
+                ReachingInfo baseInfo;
+                ReachingDefinitionAnalysis<ReachingInfo,true> memoryEdges(baseInfo, baseInfo);
+                memoryEdges.initializeMap(&F);
+                memory.fillEdges(memoryEdges);
+                memoryEdges.print();
+            }
+
+            if (chainsFile)
+                writeChains(F, chains);
+            return false;
+        }
+
+        void writeChains(Function &F, ReachingChains &chains) {
+            // one record per function: name length, name, chains
+            StringRef name = F.getName();
+            support::endian::Writer(*chainsFile, support::little).write<uint32_t>(name.size());
+            *chainsFile << name;
+            chains.write(*chainsFile);
+        }
+
+        bool doFinalization(Module &M) override {
+            chainsFile.reset();
             return false;
         }
     };
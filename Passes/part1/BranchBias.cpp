@@ -39,23 +39,311 @@ EX
 // https://llvm.org/doxygen/Module_8h_source.html
 #include "llvm/IR/Module.h"
 
+#include "llvm/Support/CommandLine.h"
+
+// appendToGlobalDtors
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+// the counters of the spanning-tree, profile and sampling modes
+#include "BranchProfile.h"
+#include "BurstSampling.h"
+#include "CounterPlacement.h"
+#include "ThreadCounters.h"
+
 // C++ STL
+#include <map>
+#include <set>
 #include <string>
 #include <vector>
 
 using namespace llvm;
 using namespace std;
 
+// run "opt -load submission_pt1.so -cse231-bb -cse231-bb-spanning-tree < input.ll > output.bc"
+static cl::opt<bool> SpanningTree("cse231-bb-spanning-tree",
+    cl::desc("Count the edges out of a spanning tree of each CFG only; taken/total are printed when main returns"),
+    cl::init(false));
+
+// run "opt -load submission_pt1.so -cse231-bb -cse231-bb-profile=branches.prof < input.ll > output.bc"
+static cl::opt<string> ProfileFile("cse231-bb-profile",
+    cl::desc("Count every conditional branch on its own and append the counts to <file> at exit (see BranchProfile.h)"),
+    cl::value_desc("file"), cl::init(""));
+
+// run "opt -load submission_pt1.so -cse231-bb -cse231-bb-sample=100 < input.ll > output.bc"
+static cl::opt<unsigned> SampleInterval("cse231-bb-sample",
+    cl::desc("Burst sampling: count about one path in N between checks and report the counts scaled by N (0: count everything)"),
+    cl::value_desc("N"), cl::init(0));
+
 namespace {
 	struct BranchIas : public FunctionPass {
         static char ID;
 
         BranchIas() : FunctionPass(ID) {}
 
+        /*
+            Spanning-tree mode (-cse231-bb-spanning-tree)
+            Instead of a call to updateBranchInfo() per conditional branch executed, only the edges out of a maximum
+            spanning tree of each CFG get an inline counter (CounterPlacement.h). The number of executions of the
+            conditional branches (total) and of their true edges (taken) are linear combinations of the counters,
+            which only hold once the invocations returned: cse231.bb.flush evaluates them when main returns, hands
+            them to updateBranchInfoN() and calls printOutBranchInfo(), which prints the sum of what the
+            default mode prints at every ret. A branch whose two successors are the same block has no edge of its own
+            and counts its true conditions directly. Modules without main keep the default mode.
+
+            Profile mode (-cse231-bb-profile=<file>)
+            taken/total are kept for every branch instead, and cse231.bb.write_profile, a global destructor, appends
+            them to <file> when the program exits; the runtime is not used. Appending lets the modules of a program
+            (and successive runs) share <file>: their records add up when it is read; remove <file> to start over. The branches are counted directly, or
+            through the spanning-tree counters if -cse231-bb-spanning-tree is given too (exact only if the program
+            leaves through main's ret).
+
+            Sampling mode (-cse231-bb-sample=N)
+            Every function gets a fast and an instrumented version (BurstSampling.h); the branches of the
+            instrumented version, which runs about 1 / N of the time, count directly, with coefficient N. taken/total
+            are printed when main returns, followed by the sampling line of BurstSampling::report(), or written to
+            the profile with -cse231-bb-profile. Without main or a profile, the default mode is kept.
+
+            The counters of these modes are thread_local (ThreadCounters.h): the flush and the profile see the
+            counts of the calling thread and of the threads that exited before.
+        */
+        struct BranchCounts {
+            unsigned index;
+            CounterPlacement::Combination taken, total;
+        };
+
+        bool spanning = false;
+        bool profiling = false;
+        bool sampling = false;
+        map<Function*, CounterPlacement> placements;
+        set<Function*> sampled;
+        BurstSampling sampler;
+        map<Function*, vector<BranchCounts>> branches;
+        vector<pair<BranchInst*, unsigned>> direct;         // branches counting their true conditions in a counter
+        vector<pair<BranchInst*, unsigned>> executions;     // branches counting their executions in a counter
+        ThreadCounters threads;
+        GlobalVariable* counters = nullptr;
+        Function* flushFunc = nullptr;
+
+        bool doInitialization(Module &M) override {
+            Function* mainFunc = M.getFunction("main");
+            spanning = SpanningTree && mainFunc && !mainFunc->isDeclaration();
+            profiling = !ProfileFile.empty();
+            sampling = SampleInterval && (profiling || (mainFunc && !mainFunc->isDeclaration()));
+            if (!spanning && !profiling && !sampling){
+                return false;
+            }
+            LLVMContext &context = M.getContext();
+
+            placements.clear();
+            branches.clear();
+            sampled.clear();
+            direct.clear();
+            executions.clear();
+            unsigned numCounters = 0;
+            for (Function &F : M){
+                if (F.isDeclaration()){
+                    continue;
+                }
+                // the counts of a sampled function are estimates: its counters count 1 / N of its branches
+                unsigned scale = 1;
+                if (sampling && BurstSampling::canSample(F)){
+                    sampled.insert(&F);
+                    scale = SampleInterval;
+                }
+                CounterPlacement* placement = nullptr;
+                if (spanning && !sampled.count(&F)){
+                    placement = &placements[&F];
+                    numCounters += placement->place(F, numCounters, true);
+                }
+                vector<BranchInst*> conditionals = BranchProfile::conditionalBranches(F);
+                for (unsigned index = 0; index < conditionals.size(); index++){
+                    BranchInst* br = conditionals[index];
+                    BranchCounts counts;
+                    counts.index = index;
+                    if (placement){
+                        counts.total = placement->blockCount(br->getParent());
+                    }
+                    else{
+                        executions.push_back(make_pair(br, numCounters));
+                        counts.total[numCounters++] = scale;
+                    }
+                    const CounterPlacement::Combination* trueEdge =
+                        placement ? placement->edgeCount(br->getParent(), br->getSuccessor(0)) : nullptr;
+                    if (trueEdge && br->getSuccessor(0) != br->getSuccessor(1)){
+                        counts.taken = *trueEdge;
+                    }
+                    else{
+                        direct.push_back(make_pair(br, numCounters));
+                        counts.taken[numCounters++] = scale;
+                    }
+                    branches[&F].push_back(counts);
+                }
+            }
+
+            threads.init(M, "cse231.bb", numCounters);
+            counters = threads.counters;
+            flushFunc = nullptr;
+            if (sampling){
+                sampler.init(M, "cse231.bb.sample", SampleInterval);
+            }
+            if (profiling){
+                buildProfileWriter(M);
+                return true;
+            }
+
+            CounterPlacement::Combination taken, total;
+            for (auto const & function : branches){
+                for (const BranchCounts &counts : function.second){
+                    CounterPlacement::add(taken, counts.taken, 1);
+                    CounterPlacement::add(total, counts.total, 1);
+                }
+            }
+            flushFunc = Function::Create(FunctionType::get(Type::getVoidTy(context), false),
+                                         GlobalValue::InternalLinkage, "cse231.bb.flush", &M);
+            buildFlush(M, taken, total, numCounters);
+            return true;
+        }
+
+        // the value of a combination of the counters, as an i64
+        Value* evaluate(IRBuilder<> &Builder, const CounterPlacement::Combination &combination){
+            Value* sum = Builder.getInt64(0);
+            for (auto const & term : combination){
+                Value* slot = Builder.CreateConstInBoundsGEP2_32(counters_type(), counters, 0, term.first);
+                sum = Builder.CreateAdd(sum, Builder.CreateMul(Builder.CreateLoad(Builder.getInt64Ty(), slot),
+                                                               Builder.getInt64(term.second)));
+            }
+            return sum;
+        }
+
+        /*
+            cse231.bb.flush
+                the counts of the exited threads are collected into the counters of this thread
+                taken, total = the combinations of the counters
+                updateBranchInfoN(taken, total)
+                printOutBranchInfo(); the counters are reset
+        */
+        void buildFlush(Module &M, const CounterPlacement::Combination &taken, const CounterPlacement::Combination &total,
+                        unsigned numCounters){
+            LLVMContext &context = M.getContext();
+            Type* int64 = Type::getInt64Ty(context);
+            FunctionCallee updateFunc = M.getOrInsertFunction("updateBranchInfoN", Type::getVoidTy(context), int64, int64);
+            FunctionCallee printFunc = M.getOrInsertFunction("printOutBranchInfo", Type::getVoidTy(context));
+
+            BasicBlock* entry = BasicBlock::Create(context, "entry", flushFunc);
+            IRBuilder<> Builder(entry);
+            threads.collect(Builder);
+            Builder.CreateCall(updateFunc, {evaluate(Builder, taken), evaluate(Builder, total)});
+            Builder.CreateCall(printFunc);
+            if (sampling){
+                sampler.report(Builder);
+            }
+            for (unsigned counter = 0; counter < numCounters; counter++){
+                Builder.CreateStore(Builder.getInt64(0), Builder.CreateConstInBoundsGEP2_32(counters_type(), counters, 0, counter));
+            }
+            Builder.CreateRetVoid();
+        }
+
+        /*
+            cse231.bb.write_profile, run at exit (llvm.global_dtors)
+                the counts of the exited threads are collected into the counters of this thread
+                file = fopen(<file>, "a")
+                fprintf(file, "func %s %u\n", ...) for each function, fprintf(file, "br %u %lld %lld\n", ...) for each branch
+                fclose(file)
+        */
+        void buildProfileWriter(Module &M){
+            LLVMContext &context = M.getContext();
+            Type* int8Ptr = Type::getInt8PtrTy(context);
+            Type* int32 = Type::getInt32Ty(context);
+            FunctionCallee openFunc = M.getOrInsertFunction("fopen", int8Ptr, int8Ptr, int8Ptr);
+            FunctionCallee printFunc = M.getOrInsertFunction("fprintf", FunctionType::get(int32, {int8Ptr, int8Ptr}, true));
+            FunctionCallee closeFunc = M.getOrInsertFunction("fclose", int32, int8Ptr);
+
+            Function* writer = Function::Create(FunctionType::get(Type::getVoidTy(context), false),
+                                                GlobalValue::InternalLinkage, "cse231.bb.write_profile", &M);
+            BasicBlock* entry = BasicBlock::Create(context, "entry", writer);
+            BasicBlock* write = BasicBlock::Create(context, "write", writer);
+            BasicBlock* done = BasicBlock::Create(context, "done", writer);
+            IRBuilder<> Builder(entry);
+            Value* file = Builder.CreateCall(openFunc, {Builder.CreateGlobalStringPtr(ProfileFile, "cse231.bb.profile.path"),
+                                                        Builder.CreateGlobalStringPtr("a", "cse231.bb.profile.mode")});
+            Builder.CreateCondBr(Builder.CreateIsNull(file), done, write);
+
+            Builder.SetInsertPoint(write);
+            threads.collect(Builder);
+            Value* functionRecord = Builder.CreateGlobalStringPtr(BranchProfile::FunctionRecord, "cse231.bb.profile.func");
+            Value* branchRecord = Builder.CreateGlobalStringPtr(BranchProfile::BranchRecord, "cse231.bb.profile.br");
+            for (auto const & function : branches){
+                Value* name = Builder.CreateGlobalStringPtr(function.first->getName(), "cse231.bb.profile.name");
+                Builder.CreateCall(printFunc, {file, functionRecord, name, Builder.getInt32(function.second.size())});
+                for (const BranchCounts &counts : function.second){
+                    Builder.CreateCall(printFunc, {file, branchRecord, Builder.getInt32(counts.index),
+                                                   evaluate(Builder, counts.taken), evaluate(Builder, counts.total)});
+                }
+            }
+            Builder.CreateCall(closeFunc, {file});
+            Builder.CreateBr(done);
+
+            Builder.SetInsertPoint(done);
+            Builder.CreateRetVoid();
+            appendToGlobalDtors(M, writer, 0);
+        }
+
+        Type* counters_type(){
+            return counters->getValueType();
+        }
+
+        void instrumentCounters(Function &F){
+            // the branches of a sampled function count in its instrumented version
+            map<BasicBlock*, BasicBlock*> copies;
+            if (sampled.count(&F) && branches.count(&F)){
+                copies = sampler.duplicate(F);
+            }
+            auto counted = [&](BranchInst* br){
+                return copies.empty() ? br : cast<BranchInst>(copies[br->getParent()]->getTerminator());
+            };
+            for (auto const & branch : direct){
+                if (branch.first->getFunction() != &F){
+                    continue;
+                }
+                BranchInst* br = counted(branch.first);
+                IRBuilder<> Builder(br);
+                Value* slot = Builder.CreateConstInBoundsGEP2_32(counters_type(), counters, 0, branch.second);
+                Value* condition = Builder.CreateZExt(br->getCondition(), Builder.getInt64Ty());
+                Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(Builder.getInt64Ty(), slot), condition), slot);
+            }
+            for (auto const & branch : executions){
+                if (branch.first->getFunction() == &F){
+                    CounterPlacement::increment(counted(branch.first), counters, branch.second);
+                }
+            }
+            auto placement = placements.find(&F);
+            if (placement != placements.end()){
+                placement->second.instrument(counters);
+            }
+
+            if (flushFunc && F.getName() == "main"){
+                for (BasicBlock &BB : F){
+                    if (isa<ReturnInst>(BB.getTerminator())){
+                        IRBuilder<> Builder(BB.getTerminator());
+                        Builder.CreateCall(flushFunc);
+                    }
+                }
+            }
+        }
+
         bool runOnFunction(Function &F) override {
+            if (spanning || profiling || sampling){
+                // the functions created after doInitialization (ours, or by another pass) are not counted
+                if (placements.count(&F) || branches.count(&F) || (flushFunc && F.getName() == "main")){
+                    instrumentCounters(F);
+                }
+                threads.enter(F);
+                return true;
+            }
+
             /*
                 mainly use the two APIs  updateBranchInfo AND  printOutInstrInfo to update the 
-                branch_count[2]  in /lib231/lib231.cpp
+                counts in lib231.cpp (per-thread shards)
 		    */
             // step 1. access the instr_map in lib231.cpp with updateInstrInfo() and  printOutInstrInfo()
             Module *module = F.getParent();
@@ -0,0 +1,115 @@
+/*  Per-branch Profiles
+    cse231-bb -cse231-bb-profile=<file> counts every conditional branch on its own and appends the counts to <file>
+    when the program exits; cse231-bb-weights -cse231-bb-use-profile=<file> reads them back and attaches
+    !prof branch_weights to the branches, for the optimizations that use them (block placement, inlining, ...).
+
+        func <name> <number of conditional branches>
+        br <index> <taken> <total>
+
+    A branch is named by its function and its index among the conditional branches of the function, in block
+    order (conditionalBranches), so the profile only applies to the IR it was collected on. The number of
+    branches of a function is recorded to detect the stale ones. The records of the same branch add up: the
+    modules of a program and successive runs append to the same file, and profiles can simply be concatenated.
+
+    The counts are printed signed: a spanning-tree count evaluated while an invocation was still active (a program
+    leaving through exit()) can be negative. Such a record, or any record that does not parse, is skipped and
+    reported, and makes its function stale; the rest of the profile is still used.
+*/
+#ifndef LLVM_TRANSFORMS_BRANCHPROFILE_H
+#define LLVM_TRANSFORMS_BRANCHPROFILE_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace llvm {
+
+class BranchProfile {
+  public:
+    // the records, as printf formats (name, branches) and (index, taken, total)
+    static constexpr const char * FunctionRecord = "func %s %u\n";
+    static constexpr const char * BranchRecord = "br %u %lld %lld\n";
+
+    struct FunctionProfile {
+        unsigned branches = 0;
+        bool stale = false;                                 // the runs disagree on the number of branches
+        map<unsigned, pair<uint64_t, uint64_t>> counts;     // index -> (taken, total)
+    };
+    map<string, FunctionProfile> functions;
+    vector<string> skipped;     // the records read() skipped, as "<file>:<line>: <reason>"
+
+    // the conditional branches of F, by index
+    static vector<BranchInst *> conditionalBranches(Function & F) {
+        vector<BranchInst *> branches;
+        for (BasicBlock & B : F) {
+            BranchInst * br = dyn_cast<BranchInst>(B.getTerminator());
+            if (br && br->isConditional())
+                branches.push_back(br);
+        }
+        return branches;
+    }
+
+    const FunctionProfile * get(StringRef name) const {
+        auto it = functions.find(name.str());
+        return it == functions.end() ? nullptr : &it->second;
+    }
+
+    /*
+     * Read a profile written by an instrumented program. Returns false and sets error if the file cannot be read;
+     * the malformed records are skipped (skipped) and make their function stale.
+     */
+    bool read(StringRef path, string & error) {
+        ErrorOr<unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(path);
+        if (!buffer) {
+            error = path.str() + ": " + buffer.getError().message();
+            return false;
+        }
+
+        FunctionProfile * current = nullptr;
+        for (line_iterator line(**buffer, true, ';'); !line.is_at_end(); ++line) {
+            SmallVector<StringRef, 4> fields;
+            line->trim().split(fields, ' ', -1, false);
+            unsigned branches = 0, index = 0;
+            int64_t taken = 0, total = 0;
+            const char * problem = nullptr;
+            if (fields.size() == 3 && fields[0] == "func" && !fields[2].getAsInteger(10, branches)) {
+                bool seen = functions.count(fields[1].str()) != 0;
+                current = &functions[fields[1].str()];
+                current->stale |= seen && current->branches != branches;
+                current->branches = branches;
+                continue;
+            }
+            if (fields.size() != 4 || fields[0] != "br" || fields[1].getAsInteger(10, index)
+                || fields[2].getAsInteger(10, taken) || fields[3].getAsInteger(10, total))
+                problem = "unexpected record";
+            else if (!current)
+                problem = "branch outside of a function";
+            else if (taken < 0 || total < 0)
+                problem = "negative count";
+            else if (taken > total)
+                problem = "taken more often than executed";
+            if (problem) {
+                skipped.push_back(path.str() + ":" + to_string(line.line_number()) + ": " + problem + " '" +
+                                  line->str() + "'");
+                if (current)
+                    current->stale = true;
+                continue;
+            }
+            pair<uint64_t, uint64_t> & counts = current->counts[index];
+            counts.first += taken;
+            counts.second += total;
+        }
+        return true;
+    }
+};
+
+}
+#endif // End LLVM_TRANSFORMS_BRANCHPROFILE_H
@@ -0,0 +1,90 @@
+/*
+read the per-branch profile written by a program instrumented with cse231-bb -cse231-bb-profile=<file> (BranchProfile.h)
+and attach the counts to the conditional branches as branch weights:
+    br i1 %cond, label %taken, label %not.taken, !prof !{!"branch_weights", i32 [taken], i32 [total - taken]}
+The IR must be the one that was instrumented: the branches are matched by function name and index, and the functions
+whose number of conditional branches differs from the profile are left alone.
+*/
+
+#include "llvm/Pass.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "BranchProfile.h"
+
+// C++ STL
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+// run "opt -load submission_pt1.so -cse231-bb-weights -cse231-bb-use-profile=branches.prof < input.ll > output.bc"
+static cl::opt<string> UseProfile("cse231-bb-use-profile",
+    cl::desc("The branch profile to read (written by cse231-bb -cse231-bb-profile)"),
+    cl::value_desc("file"), cl::init(""));
+
+namespace {
+	struct BranchWeights : public FunctionPass {
+        static char ID;
+        BranchProfile profile;
+
+        BranchWeights() : FunctionPass(ID) {}
+
+        bool doInitialization(Module &M) override {
+            profile = BranchProfile();
+            string error;
+            if (UseProfile.empty()){
+                errs() << "cse231-bb-weights: no profile, use -cse231-bb-use-profile=<file>\n";
+            }
+            else if (!profile.read(UseProfile, error)){
+                errs() << "cse231-bb-weights: cannot read the profile " << error << "\n";
+                profile = BranchProfile();
+            }
+            for (const string &record : profile.skipped){
+                errs() << "cse231-bb-weights: skipped " << record << "\n";
+            }
+            return false;
+        }
+
+        bool runOnFunction(Function &F) override {
+            const BranchProfile::FunctionProfile* counts = profile.get(F.getName());
+            if (!counts){
+                return false;
+            }
+            vector<BranchInst*> branches = BranchProfile::conditionalBranches(F);
+            if (counts->stale || counts->branches != branches.size()){
+                errs() << "cse231-bb-weights: the profile of " << F.getName() << " is stale or does not match its branches, ignored\n";
+                return false;
+            }
+
+            MDBuilder MDB(F.getContext());
+            bool changed = false;
+            for (auto const & branch : counts->counts){
+                uint64_t taken = branch.second.first;
+                uint64_t notTaken = branch.second.second - taken;
+                // never executed: no weights (as PGO does), rather than 0:0
+                if (branch.first >= branches.size() || branch.second.second == 0){
+                    continue;
+                }
+                // the weights are 32 bits: scale both down until they fit
+                while (std::max(taken, notTaken) > UINT32_MAX){
+                    taken >>= 1;
+                    notTaken >>= 1;
+                }
+                branches[branch.first]->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(taken, notTaken));
+                changed = true;
+            }
+            return changed;
+        }
+	};
+}
+
+char BranchWeights::ID = 0;
+static RegisterPass<BranchWeights> Y("cse231-bb-weights", "attaches the branch weights of a cse231-bb profile to the branches",
+                             false /* Only looks at CFG */,
+                             false /* Analysis Pass */);
@@ -0,0 +1,248 @@
+/*  Burst Sampling (Arnold & Ryder)
+    Counting every execution of the instrumented code is too slow for production runs; sampling counts about
+    one in N of them and scales the counts by N. Every function gets two versions of its body: the fast version
+    (the original code) and the instrumented version (a copy, where the counters go). Checks on the function
+    entry and on the back edges of its loops decrement a global countdown: when it expires, control goes to the
+    instrumented version, which runs until the next back edge or ret (a burst); its back edges go to the checks.
+    A check costs a load, a decrement, a store and a branch; the instrumented version runs 1 / N of the time.
+
+    Every block execution belongs to one check-to-check path, and about one path in N is sampled: a count of the
+    instrumented version times N estimates the count of the program. The countdown is reset to a random value
+    in 1 .. 2N - 1 (mean N) rather than N, so that a loop whose behavior repeats with a period dividing N cannot
+    bias the samples. The error of the estimates is reported with them: with s samples, the number of paths is
+    known within 1.96 * sqrt((N - 1) / (N * s)) (95%), the error of the counts made of many paths; the count C
+    of a rare event is only known within about 1.96 * sqrt(C * (N - 1)).
+
+    Every thread has its own countdown and seed (thread_local); the number of samples is shared (atomic adds).
+    Functions with indirectbr, callbr or exception handling pads are not sampled (canSample).
+*/
+#ifndef LLVM_TRANSFORMS_BURSTSAMPLING_H
+#define LLVM_TRANSFORMS_BURSTSAMPLING_H
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include "ThreadCounters.h"
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace llvm {
+
+class BurstSampling {
+  public:
+    uint64_t interval = 0;      // N
+
+    // false if F cannot be sampled (indirectbr, callbr, EH pads)
+    static bool canSample(Function & F) {
+        for (BasicBlock & B : F) {
+            if (B.isEHPad() || isa<IndirectBrInst>(B.getTerminator()) || isa<CallBrInst>(B.getTerminator()))
+                return false;
+        }
+        return true;
+    }
+
+    /*
+     * Create the state of the sampling in M, named prefix.*: the countdown, the seed of its random resets, the
+     * number of samples, and prefix.next, the function resetting the countdown when it expires.
+     */
+    void init(Module & M, StringRef prefix, uint64_t N) {
+        LLVMContext & context = M.getContext();
+        Type * int64 = Type::getInt64Ty(context);
+        interval = N;
+        auto global = [&](const char * name, uint64_t value, bool threadLocal) {
+            return new GlobalVariable(M, int64, false, GlobalValue::InternalLinkage, ConstantInt::get(int64, value),
+                                      prefix + name, nullptr,
+                                      threadLocal ? GlobalValue::GeneralDynamicTLSModel : GlobalValue::NotThreadLocal);
+        };
+        countdown = global(".countdown", N, true);
+        seed = global(".seed", 0x9E3779B97F4A7C15ULL, true);
+        samples = global(".samples", 0, false);
+
+        // next: seed = xorshift64(seed); countdown = 1 + seed % (2N - 1); samples++
+        next = Function::Create(FunctionType::get(Type::getVoidTy(context), false), GlobalValue::InternalLinkage,
+                                prefix + ".next", &M);
+        next->addFnAttr(Attribute::NoInline);
+        next->addFnAttr(Attribute::Cold);
+        IRBuilder<> irBuilder(BasicBlock::Create(context, "entry", next));
+        Value * x = irBuilder.CreateLoad(int64, seed);
+        x = irBuilder.CreateXor(x, irBuilder.CreateShl(x, 13));
+        x = irBuilder.CreateXor(x, irBuilder.CreateLShr(x, 7));
+        x = irBuilder.CreateXor(x, irBuilder.CreateShl(x, 17));
+        irBuilder.CreateStore(x, seed);
+        Value * reset = irBuilder.CreateURem(x, irBuilder.getInt64(2 * N - 1));
+        irBuilder.CreateStore(irBuilder.CreateAdd(reset, irBuilder.getInt64(1)), countdown);
+        ThreadCounters::atomic(irBuilder, AtomicRMWInst::Add, samples, irBuilder.getInt64(1));
+        irBuilder.CreateRetVoid();
+    }
+
+    /*
+     * Give F a fast and an instrumented version; returns the copy of every block of F in the instrumented version,
+     * where the caller puts its counters (the blocks of F are the fast version, and stay uninstrumented).
+     * The allocas of the entry block move to a new entry block shared by the two versions.
+     */
+    map<BasicBlock *, BasicBlock *> duplicate(Function & F) {
+        LLVMContext & context = F.getContext();
+        BasicBlock * entry = &F.getEntryBlock();
+        vector<AllocaInst *> staticAllocas;
+        for (Instruction & I : *entry) {
+            AllocaInst * alloca = dyn_cast<AllocaInst>(&I);
+            if (alloca && alloca->isStaticAlloca())
+                staticAllocas.push_back(alloca);
+        }
+        BasicBlock * prologue = BasicBlock::Create(context, "prologue", &F, entry);
+        BranchInst * enter = BranchInst::Create(entry, prologue);
+        for (AllocaInst * alloca : staticAllocas)
+            alloca->moveBefore(enter);
+
+        // reg2mem: once no value crosses a block boundary, blocks can be copied and edges redirected freely
+        vector<Instruction *> values;
+        vector<PHINode *> phis;
+        for (BasicBlock & B : F) {
+            if (&B == prologue)
+                continue;
+            for (Instruction & I : B) {
+                if (PHINode * phi = dyn_cast<PHINode>(&I))
+                    phis.push_back(phi);
+                else if (escapes(I))
+                    values.push_back(&I);
+            }
+        }
+        vector<AllocaInst *> slots;
+        for (Instruction * I : values)
+            slots.push_back(DemoteRegToStack(*I, false, enter));
+        for (PHINode * phi : phis)
+            slots.push_back(DemotePHIToStack(phi, enter));
+
+        // the back edges, where the fast version checks the countdown
+        vector<pair<BasicBlock *, BasicBlock *>> backEdges;
+        {
+            DominatorTree DT(F);
+            LoopInfo LI(DT);
+            set<pair<BasicBlock *, BasicBlock *>> seen;
+            for (Loop * L : LI.getLoopsInPreorder()) {
+                for (BasicBlock * pred : predecessors(L->getHeader())) {
+                    if (L->contains(pred) && seen.insert(make_pair(pred, L->getHeader())).second)
+                        backEdges.push_back(make_pair(pred, L->getHeader()));
+                }
+            }
+        }
+
+        // the instrumented version
+        vector<BasicBlock *> blocks;
+        for (BasicBlock & B : F) {
+            if (&B != prologue)
+                blocks.push_back(&B);
+        }
+        ValueToValueMapTy VMap;
+        map<BasicBlock *, BasicBlock *> copies;
+        for (BasicBlock * B : blocks) {
+            BasicBlock * copy = CloneBasicBlock(B, VMap, ".sampled", &F);
+            VMap[B] = copy;
+            copies[B] = copy;
+        }
+        for (auto const & block : copies) {
+            for (Instruction & I : *block.second)
+                RemapInstruction(&I, VMap, RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+        }
+
+        // the checks: at the entry and on the back edges; a back edge of the instrumented version ends the burst
+        // and goes to the check of the fast version
+        redirect(enter, entry, check(F, entry, copies[entry]));
+        for (auto const & edge : backEdges) {
+            BasicBlock * checkBlock = check(F, edge.second, copies[edge.second]);
+            redirect(edge.first->getTerminator(), edge.second, checkBlock);
+            redirect(copies[edge.first]->getTerminator(), copies[edge.second], checkBlock);
+        }
+
+        DominatorTree DT(F);
+        PromoteMemToReg(slots, DT);
+        return copies;
+    }
+
+    /*
+     * Print the sampling rate, the number of samples and the error of the estimates to stderr, and reset the
+     * number of samples (with the counters, by the caller):
+     *     sampling\t1/[N]\t[samples] samples\t+-[error]%
+     */
+    void report(IRBuilder<> & irBuilder) {
+        Module * M = irBuilder.GetInsertBlock()->getModule();
+        LLVMContext & context = M->getContext();
+        Type * doubleType = irBuilder.getDoubleTy();
+        FunctionCallee printFunc = M->getOrInsertFunction("dprintf",
+            FunctionType::get(irBuilder.getInt32Ty(), {irBuilder.getInt32Ty(), Type::getInt8PtrTy(context)}, true));
+
+        Value * count = ThreadCounters::atomic(irBuilder, AtomicRMWInst::Xchg, samples, irBuilder.getInt64(0));
+        // 196 * sqrt((N - 1) / (N * max(s, 1))), in percent
+        Value * s = irBuilder.CreateUIToFP(irBuilder.CreateSelect(irBuilder.CreateICmpEQ(count, irBuilder.getInt64(0)),
+                                                                  irBuilder.getInt64(1), count), doubleType);
+        Value * variance = irBuilder.CreateFDiv(ConstantFP::get(doubleType, double(interval - 1) / interval), s);
+        Value * error = irBuilder.CreateFMul(ConstantFP::get(doubleType, 196.0),
+                                             irBuilder.CreateUnaryIntrinsic(Intrinsic::sqrt, variance));
+        irBuilder.CreateCall(printFunc, {irBuilder.getInt32(2),
+                                         irBuilder.CreateGlobalStringPtr("sampling\t1/%llu\t%llu samples\t+-%.2f%%\n"),
+                                         irBuilder.getInt64(interval), count, error});
+    }
+
+  private:
+    GlobalVariable * countdown = nullptr;
+    GlobalVariable * seed = nullptr;
+    GlobalVariable * samples = nullptr;
+    Function * next = nullptr;
+
+    // used outside of its block or by a phi (as in reg2mem)
+    static bool escapes(Instruction & I) {
+        for (User * user : I.users()) {
+            Instruction * UI = cast<Instruction>(user);
+            if (UI->getParent() != I.getParent() || isa<PHINode>(UI))
+                return true;
+        }
+        return false;
+    }
+
+    static void redirect(Instruction * terminator, BasicBlock * from, BasicBlock * to) {
+        for (unsigned i = 0; i < terminator->getNumSuccessors(); i++) {
+            if (terminator->getSuccessor(i) == from)
+                terminator->setSuccessor(i, to);
+        }
+    }
+
+    /*
+     * sample.check:   if (--countdown == 0) { next(); goto sampled; } else goto fast;
+     */
+    BasicBlock * check(Function & F, BasicBlock * fast, BasicBlock * sampled) {
+        LLVMContext & context = F.getContext();
+        Type * int64 = Type::getInt64Ty(context);
+        BasicBlock * checkBlock = BasicBlock::Create(context, "sample.check", &F, fast);
+        BasicBlock * sampleBlock = BasicBlock::Create(context, "sample.start", &F, fast);
+
+        IRBuilder<> irBuilder(checkBlock);
+        Value * left = irBuilder.CreateSub(irBuilder.CreateLoad(int64, countdown), irBuilder.getInt64(1));
+        irBuilder.CreateStore(left, countdown);
+        MDBuilder MDB(context);
+        irBuilder.CreateCondBr(irBuilder.CreateICmpEQ(left, irBuilder.getInt64(0)), sampleBlock, fast,
+                               MDB.createBranchWeights(1, interval > 1 ? interval - 1 : 1));
+
+        irBuilder.SetInsertPoint(sampleBlock);
+        irBuilder.CreateCall(next);
+        irBuilder.CreateBr(sampled);
+        return checkBlock;
+    }
+};
+
+}
+#endif // End LLVM_TRANSFORMS_BURSTSAMPLING_H
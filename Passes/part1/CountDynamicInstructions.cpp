@@ -39,25 +39,361 @@
 // https://llvm.org/doxygen/Module_8h_source.html
 #include "llvm/IR/Module.h"
 
+#include "llvm/Support/CommandLine.h"
+
+// the counters of the spanning-tree and sampling modes
+#include "BurstSampling.h"
+#include "CounterPlacement.h"
+#include "ThreadCounters.h"
+
 // C++ STL
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
 using namespace llvm;
 using namespace std;
 
+// run "opt -load submission_pt1.so -cse231-cdi -cse231-cdi-inline < input.ll > output.bc"
+static cl::opt<bool> InlineCounters("cse231-cdi-inline",
+    cl::desc("Count block executions in a module-level array instead of calling updateInstrInfo in every block"),
+    cl::init(false));
+
+// run "opt -load submission_pt1.so -cse231-cdi -cse231-cdi-spanning-tree < input.ll > output.bc"
+static cl::opt<bool> SpanningTree("cse231-cdi-spanning-tree",
+    cl::desc("Inline counters on the edges out of a spanning tree of each CFG only; the histogram is printed when main returns"),
+    cl::init(false));
+
+// run "opt -load submission_pt1.so -cse231-cdi -cse231-cdi-sample=100 < input.ll > output.bc"
+static cl::opt<unsigned> SampleInterval("cse231-cdi-sample",
+    cl::desc("Burst sampling: count about one path in N between checks and print the histogram scaled by N (0: count everything)"),
+    cl::value_desc("N"), cl::init(0));
+
 namespace {
 	struct CountDynamicInstructions : public FunctionPass {
         /*
             mainly use the two APIs  updateInstrInfo AND  printOutInstrInfo to update the 
-            instr_map  in /lib231/lib231.cpp
+            counts in lib231.cpp (per-thread shards)
 		*/
         static char ID;
 
 		CountDynamicInstructions() : FunctionPass(ID) {}
 
+        /*
+            Inline counter mode (-cse231-cdi-inline)
+            Every basic block gets an index in the module-level array cse231.cdi.counters, and a single
+            load/add/store of its counter instead of the call to updateInstrInfo().
+            Before each ret, cse231.cdi.flush rebuilds the opcode histogram from the counters and the static
+            per-block tables (opcode, count), hands it to updateInstrInfo64() in a single call, resets the counters
+            and calls printOutInstrInfo(): the runtime prints the same output.
+            The tables and cse231.cdi.flush are built by doInitialization, from the blocks of the module before any
+            function is instrumented (the doFinalization of a function pass runs after the module is written out).
+            The counters only cover the blocks of the module; in a program of several instrumented modules, the
+            counts of a module are printed at the next ret of one of its own functions.
+            The counters are thread_local (ThreadCounters.h): a flush prints the counts of the calling thread and
+            of the threads that exited since the last flush.
+
+            Spanning-tree mode (-cse231-cdi-spanning-tree)
+            Only the edges out of a maximum spanning tree of each CFG are counted (CounterPlacement.h); the count of
+            a block is a linear combination of these counters. The combinations only hold for invocations that
+            returned, so the histogram is printed once, when main returns: the sum of what the other modes print at
+            every ret. Modules without main keep one counter per block.
+
+            Sampling mode (-cse231-cdi-sample=N)
+            Every function gets a fast and an instrumented version (BurstSampling.h); only the instrumented version,
+            which runs about 1 / N of the time, increments the block counters, and the flush scales them by N (the
+            coefficients of the counters). The histogram is printed when main returns (at every ret if the module
+            has no main), followed by the sampling line of BurstSampling::report(). Functions that cannot be
+            sampled count every block execution.
+        */
+        map<Function*, CounterPlacement> placements;
+        set<Function*> sampled;
+        BurstSampling sampler;
+        bool flushInMainOnly = false;
+        ThreadCounters threads;
+        GlobalVariable* counters = nullptr;
+        Function* flushFunc = nullptr;
+
+        bool doInitialization(Module &M) override {
+            if (!InlineCounters && !SpanningTree && !SampleInterval){
+                return false;
+            }
+            LLVMContext &context = M.getContext();
+            Function* mainFunc = M.getFunction("main");
+            flushInMainOnly = (SpanningTree || SampleInterval) && mainFunc && !mainFunc->isDeclaration();
+
+            placements.clear();
+            sampled.clear();
+            unsigned numCounters = 0;
+            vector<map<unsigned, unsigned>> blockOpcodes;           // block -> opcode -> count
+            vector<CounterPlacement::Combination> blockCounts;      // block -> its count from the counters
+            for (Function &F : M){
+                if (F.isDeclaration()){
+                    continue;
+                }
+                CounterPlacement &placement = placements[&F];
+                numCounters += placement.place(F, numCounters, flushInMainOnly && !SampleInterval);
+                // the counts of a sampled function are estimates: its counters count 1 / N of its blocks
+                unsigned scale = 1;
+                if (SampleInterval && BurstSampling::canSample(F)){
+                    sampled.insert(&F);
+                    scale = SampleInterval;
+                }
+                for (BasicBlock &B : F){
+                    blockOpcodes.push_back(map<unsigned, unsigned>());
+                    for (Instruction &I : B){
+                        ++blockOpcodes.back()[I.getOpcode()];
+                    }
+                    blockCounts.push_back(CounterPlacement::Combination());
+                    CounterPlacement::add(blockCounts.back(), placement.blockCount(&B), scale);
+                }
+            }
+
+            threads.init(M, "cse231.cdi", numCounters);
+            counters = threads.counters;
+            if (SampleInterval){
+                sampler.init(M, "cse231.cdi.sample", SampleInterval);
+            }
+            flushFunc = Function::Create(FunctionType::get(Type::getVoidTy(context), false),
+                                         GlobalValue::InternalLinkage, "cse231.cdi.flush", &M);
+            buildFlush(M, blockOpcodes, blockCounts, numCounters);
+            return true;
+        }
+
+        void instrumentInline(Function &F){
+            auto placement = placements.find(&F);
+            if (placement == placements.end()){
+                return;     // created after doInitialization by another pass
+            }
+            if (sampled.count(&F)){
+                // one counter per block, in the instrumented version
+                map<BasicBlock*, BasicBlock*> copies = sampler.duplicate(F);
+                for (auto const & block : copies){
+                    unsigned counter = placement->second.blockCount(block.first).begin()->first;
+                    CounterPlacement::increment(block.second->getTerminator(), counters, counter);
+                }
+            }
+            else{
+                placement->second.instrument(counters);
+            }
+
+            if (!flushInMainOnly || F.getName() == "main"){
+                for (BasicBlock &B : F){
+                    if (isa<ReturnInst>(B.getTerminator())){
+                        IRBuilder<> irBuilder(B.getTerminator());
+                        irBuilder.CreateCall(flushFunc);
+                    }
+                }
+            }
+            threads.enter(F);
+        }
+
+        template <typename T>
+        GlobalVariable* createTable(Module &M, const vector<T> &data, bool constant, const char* name){
+            LLVMContext &context = M.getContext();
+            ArrayType* array_type = ArrayType::get(IntegerType::get(context, 8 * sizeof(T)), data.size());
+            Constant* init = constant ? ConstantDataArray::get(context, makeArrayRef(data)) : ConstantAggregateZero::get(array_type);
+            return new GlobalVariable(M, array_type, constant, GlobalValue::InternalLinkage, init, name);
+        }
+
+        /*
+            cse231.cdi.flush
+                the counts of the exited threads are collected into the counters of this thread
+                for every block b:
+                    c = sum of coef * counters[counter], for the entries crows[b] .. crows[b+1] of ccols/ccoefs
+                    if c != 0: totals[opcode] += c * count, for the entries rows[b] .. rows[b+1] of cols/vals
+                the counters are reset
+                the non-zero totals are compacted into keys/values and reset
+                updateInstrInfo64(n, keys, values); printOutInstrInfo()
+            The totals are 64 bits, as the counters.
+            The tables are in CSR form, by block: rows indexes cols (opcode numbers, dense) and vals (counts),
+            crows indexes ccols (counters) and ccoefs (coefficients; 1 for the block's own counter in inline mode).
+        */
+        void buildFlush(Module &M, const vector<map<unsigned, unsigned>> &blockOpcodes,
+                        const vector<CounterPlacement::Combination> &blockCounts, unsigned numCounters){
+            LLVMContext &context = M.getContext();
+            Type* int32 = Type::getInt32Ty(context);
+            Type* int64 = Type::getInt64Ty(context);
+
+            map<unsigned, unsigned> opcodeNumber;   // opcode -> dense number
+            for (const auto& block : blockOpcodes){
+                for (const auto& it : block){
+                    opcodeNumber.insert(make_pair(it.first, 0));
+                }
+            }
+            vector<uint32_t> opcodes;
+            for (auto& it : opcodeNumber){
+                it.second = opcodes.size();
+                opcodes.push_back(it.first);
+            }
+            vector<uint32_t> rows(1, 0), cols, vals;
+            for (const auto& block : blockOpcodes){
+                for (const auto& it : block){
+                    cols.push_back(opcodeNumber[it.first]);
+                    vals.push_back(it.second);
+                }
+                rows.push_back(cols.size());
+            }
+            vector<uint32_t> crows(1, 0), ccols;
+            vector<uint64_t> ccoefs;
+            for (const auto& count : blockCounts){
+                for (const auto& term : count){
+                    ccols.push_back(term.first);
+                    ccoefs.push_back(term.second);
+                }
+                crows.push_back(ccols.size());
+            }
+
+            GlobalVariable* rowsTable = createTable(M, rows, true, "cse231.cdi.rows");
+            GlobalVariable* colsTable = createTable(M, cols, true, "cse231.cdi.cols");
+            GlobalVariable* valsTable = createTable(M, vals, true, "cse231.cdi.vals");
+            GlobalVariable* crowsTable = createTable(M, crows, true, "cse231.cdi.crows");
+            GlobalVariable* ccolsTable = createTable(M, ccols, true, "cse231.cdi.ccols");
+            GlobalVariable* ccoefsTable = createTable(M, ccoefs, true, "cse231.cdi.ccoefs");
+            GlobalVariable* opcodesTable = createTable(M, opcodes, true, "cse231.cdi.opcodes");
+            GlobalVariable* totals = createTable(M, vector<uint64_t>(opcodes.size()), false, "cse231.cdi.totals");
+            GlobalVariable* keys = createTable(M, vector<uint32_t>(opcodes.size()), false, "cse231.cdi.keys");
+            GlobalVariable* values = createTable(M, vector<uint64_t>(opcodes.size()), false, "cse231.cdi.values");
+
+            FunctionCallee updateFunc = M.getOrInsertFunction("updateInstrInfo64", Type::getVoidTy(context),
+                                        int32, Type::getInt32PtrTy(context), Type::getInt64PtrTy(context));
+            FunctionCallee printFunc = M.getOrInsertFunction("printOutInstrInfo", Type::getVoidTy(context));
+
+            BasicBlock* entry = BasicBlock::Create(context, "entry", flushFunc);
+            BasicBlock* blockHead = BasicBlock::Create(context, "block", flushFunc);
+            BasicBlock* blockStart = BasicBlock::Create(context, "block.start", flushFunc);
+            BasicBlock* termHead = BasicBlock::Create(context, "term", flushFunc);
+            BasicBlock* termBody = BasicBlock::Create(context, "term.body", flushFunc);
+            BasicBlock* blockBody = BasicBlock::Create(context, "block.body", flushFunc);
+            BasicBlock* entryHead = BasicBlock::Create(context, "entry.loop", flushFunc);
+            BasicBlock* entryBody = BasicBlock::Create(context, "entry.body", flushFunc);
+            BasicBlock* blockNext = BasicBlock::Create(context, "block.next", flushFunc);
+            BasicBlock* resetHead = BasicBlock::Create(context, "reset", flushFunc);
+            BasicBlock* resetBody = BasicBlock::Create(context, "reset.body", flushFunc);
+            BasicBlock* compactHead = BasicBlock::Create(context, "compact", flushFunc);
+            BasicBlock* compactBody = BasicBlock::Create(context, "compact.body", flushFunc);
+            BasicBlock* compactKeep = BasicBlock::Create(context, "compact.keep", flushFunc);
+            BasicBlock* compactNext = BasicBlock::Create(context, "compact.next", flushFunc);
+            BasicBlock* done = BasicBlock::Create(context, "done", flushFunc);
+
+            auto element = [&](IRBuilder<> &irBuilder, GlobalVariable* table, Value* index){
+                return irBuilder.CreateInBoundsGEP(table->getValueType(), table, {ConstantInt::get(int32, 0), index});
+            };
+            Constant* zero = ConstantInt::get(int32, 0);
+            Constant* one = ConstantInt::get(int32, 1);
+
+            IRBuilder<> irBuilder(entry);
+            threads.collect(irBuilder);
+            irBuilder.CreateBr(blockHead);
+
+            // for every block
+            irBuilder.SetInsertPoint(blockHead);
+            PHINode* b = irBuilder.CreatePHI(int32, 2, "b");
+            b->addIncoming(zero, entry);
+            irBuilder.CreateCondBr(irBuilder.CreateICmpULT(b, ConstantInt::get(int32, blockOpcodes.size())), blockStart, resetHead);
+
+            // its count, from the counters
+            irBuilder.SetInsertPoint(blockStart);
+            Value* termStart = irBuilder.CreateLoad(int32, element(irBuilder, crowsTable, b));
+            Value* termEnd = irBuilder.CreateLoad(int32, element(irBuilder, crowsTable, irBuilder.CreateAdd(b, one)));
+            irBuilder.CreateBr(termHead);
+
+            irBuilder.SetInsertPoint(termHead);
+            PHINode* j = irBuilder.CreatePHI(int32, 2, "j");
+            PHINode* count = irBuilder.CreatePHI(int64, 2, "count");
+            j->addIncoming(termStart, blockStart);
+            count->addIncoming(ConstantInt::get(int64, 0), blockStart);
+            irBuilder.CreateCondBr(irBuilder.CreateICmpULT(j, termEnd), termBody, blockBody);
+
+            irBuilder.SetInsertPoint(termBody);
+            Value* counter = irBuilder.CreateLoad(int64, element(irBuilder, counters, irBuilder.CreateLoad(int32, element(irBuilder, ccolsTable, j))));
+            Value* coef = irBuilder.CreateLoad(int64, element(irBuilder, ccoefsTable, j));
+            count->addIncoming(irBuilder.CreateAdd(count, irBuilder.CreateMul(coef, counter)), termBody);
+            j->addIncoming(irBuilder.CreateAdd(j, one), termBody);
+            irBuilder.CreateBr(termHead);
+
+            irBuilder.SetInsertPoint(blockBody);
+            Value* start = irBuilder.CreateLoad(int32, element(irBuilder, rowsTable, b));
+            Value* end = irBuilder.CreateLoad(int32, element(irBuilder, rowsTable, irBuilder.CreateAdd(b, one)));
+            irBuilder.CreateCondBr(irBuilder.CreateICmpEQ(count, ConstantInt::get(int64, 0)), blockNext, entryHead);
+
+            // for every (opcode, count) of the block
+            irBuilder.SetInsertPoint(entryHead);
+            PHINode* e = irBuilder.CreatePHI(int32, 2, "e");
+            e->addIncoming(start, blockBody);
+            irBuilder.CreateCondBr(irBuilder.CreateICmpULT(e, end), entryBody, blockNext);
+
+            irBuilder.SetInsertPoint(entryBody);
+            Value* col = irBuilder.CreateLoad(int32, element(irBuilder, colsTable, e));
+            Value* val = irBuilder.CreateLoad(int32, element(irBuilder, valsTable, e));
+            Value* total = element(irBuilder, totals, col);
+            irBuilder.CreateStore(irBuilder.CreateAdd(irBuilder.CreateLoad(int64, total),
+                                                      irBuilder.CreateMul(count, irBuilder.CreateZExt(val, int64))), total);
+            e->addIncoming(irBuilder.CreateAdd(e, one), entryBody);
+            irBuilder.CreateBr(entryHead);
+
+            irBuilder.SetInsertPoint(blockNext);
+            b->addIncoming(irBuilder.CreateAdd(b, one), blockNext);
+            irBuilder.CreateBr(blockHead);
+
+            // reset the counters
+            irBuilder.SetInsertPoint(resetHead);
+            PHINode* r = irBuilder.CreatePHI(int32, 2, "r");
+            r->addIncoming(zero, blockHead);
+            irBuilder.CreateCondBr(irBuilder.CreateICmpULT(r, ConstantInt::get(int32, numCounters)), resetBody, compactHead);
+
+            irBuilder.SetInsertPoint(resetBody);
+            irBuilder.CreateStore(ConstantInt::get(int64, 0), element(irBuilder, counters, r));
+            r->addIncoming(irBuilder.CreateAdd(r, one), resetBody);
+            irBuilder.CreateBr(resetHead);
+
+            // compact the non-zero totals into keys/values
+            irBuilder.SetInsertPoint(compactHead);
+            PHINode* k = irBuilder.CreatePHI(int32, 2, "k");
+            PHINode* n = irBuilder.CreatePHI(int32, 2, "n");
+            k->addIncoming(zero, resetHead);
+            n->addIncoming(zero, resetHead);
+            irBuilder.CreateCondBr(irBuilder.CreateICmpULT(k, ConstantInt::get(int32, opcodes.size())), compactBody, done);
+
+            irBuilder.SetInsertPoint(compactBody);
+            Value* slot = element(irBuilder, totals, k);
+            Value* sum = irBuilder.CreateLoad(int64, slot);
+            irBuilder.CreateStore(ConstantInt::get(int64, 0), slot);
+            irBuilder.CreateCondBr(irBuilder.CreateICmpNE(sum, ConstantInt::get(int64, 0)), compactKeep, compactNext);
+
+            irBuilder.SetInsertPoint(compactKeep);
+            irBuilder.CreateStore(irBuilder.CreateLoad(int32, element(irBuilder, opcodesTable, k)), element(irBuilder, keys, n));
+            irBuilder.CreateStore(sum, element(irBuilder, values, n));
+            Value* kept = irBuilder.CreateAdd(n, one);
+            irBuilder.CreateBr(compactNext);
+
+            irBuilder.SetInsertPoint(compactNext);
+            PHINode* next = irBuilder.CreatePHI(int32, 2);
+            next->addIncoming(n, compactBody);
+            next->addIncoming(kept, compactKeep);
+            n->addIncoming(next, compactNext);
+            k->addIncoming(irBuilder.CreateAdd(k, one), compactNext);
+            irBuilder.CreateBr(compactHead);
+
+            irBuilder.SetInsertPoint(done);
+            irBuilder.CreateCall(updateFunc, {n, irBuilder.CreatePointerCast(keys, Type::getInt32PtrTy(context)),
+                                              irBuilder.CreatePointerCast(values, Type::getInt64PtrTy(context))});
+            irBuilder.CreateCall(printFunc);
+            if (SampleInterval){
+                sampler.report(irBuilder);
+            }
+            irBuilder.CreateRetVoid();
+        }
+
 		bool runOnFunction(Function &F) override {
+            if (InlineCounters || SpanningTree || SampleInterval){
+                if (&F != flushFunc){
+                    instrumentInline(F);
+                }
+                return true;
+            }
+
             // step 1. access the instr_map in lib231.cpp with updateInstrInfo() and  printOutInstrInfo()
 			Module *module = F.getParent();     // access module symbol table
             LLVMContext &context = module->getContext();    //get syntax environment context?
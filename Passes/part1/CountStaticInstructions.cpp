@@ -11,6 +11,7 @@ For example, if the pass processes a function that consists of 2 load and 3 add
 #include "llvm/Pass.h"
 #include "llvm/IR/Function.h"   
 #include "llvm/IR/InstIterator.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include <map>
 #include <string>
@@ -18,6 +19,13 @@ For example, if the pass processes a function that consists of 2 load and 3 add
 using namespace llvm;
 using namespace std;
 
+// run on the input and on the output of a transform for a before/after report, e.g.
+// opt -load submission_pt1.so -load submission_pt4.so -cse231-csi -cse231-csi-total -cse231-constprop -cse231-constprop-transform < input.ll > output.bc
+// opt -load submission_pt1.so -cse231-csi -cse231-csi-total < output.bc > /dev/null
+static cl::opt<bool> PrintTotal("cse231-csi-total",
+    cl::desc("Also print the function name and its total instruction count"),
+    cl::init(false));
+
 namespace {
 struct CountStaticInstructions : public FunctionPass {  
   // This declares a CountStaticInstructions class that is a subclass of FunctionPass. 
@@ -29,12 +37,14 @@ struct CountStaticInstructions : public FunctionPass {
     //This declares pass identifier used by LLVM to identify pass. 
     //This allows LLVM to avoid using expensive C++ runtime information.
     map<string, int> counter; // map OpCodeName to freq
+    int total = 0;
 
     // step 1: Iterating over the Instruction in a Function and add to counter map
     // F is a pointer to a Function instance
     for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I){
       string name((*I).getOpcodeName());  //OR getOpcode()
       counter[name]++;  
+      total++;
     }
 
     // step 2: iterate the counter map and output
@@ -42,6 +52,9 @@ struct CountStaticInstructions : public FunctionPass {
       // output format: errs() << "Hello: ";  OR  errs().write_escaped(F.getName()) << '\n';
       errs() << (it->first) << "\t" << it->second << "\n";  // OR mapCodeToName()
     }
+    if (PrintTotal) {
+      errs() << "total " << F.getName() << "\t" << total << "\n";
+    }
 
     return false;    
   }
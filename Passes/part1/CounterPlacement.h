@@ -0,0 +1,271 @@
+/*  Spanning-tree Counter Placement
+    Counting every block costs one increment per block executed. With a virtual node V, an edge V -> entry and an
+    edge from every exit block (ret, unreachable, ...) to V, the CFG obeys flow conservation: for every node, the
+    counts of the edges entering it add up to the counts of the edges leaving it. The counts of the edges of a
+    spanning tree therefore follow from the counts of the other edges (Knuth), which are the only ones counted.
+
+    The tree is a maximum spanning tree for static weights (8 ^ loop depth), so the edges of inner loops are the
+    ones left uncounted. The count of every edge and every block is a linear combination of the counters,
+    computed here at compile time; the runtime only evaluates it.
+
+    Flow conservation only holds for the invocations that returned: the combinations are exact once no invocation
+    of the function is active (e.g. when main returns), not while it runs.
+
+    Functions with indirectbr, callbr or exception handling pads (whose edges cannot be split) are counted per
+    block instead: one counter per block, and no edge counts.
+*/
+#ifndef LLVM_TRANSFORMS_COUNTERPLACEMENT_H
+#define LLVM_TRANSFORMS_COUNTERPLACEMENT_H
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace llvm {
+
+class CounterPlacement {
+  public:
+    typedef map<unsigned, int64_t> Combination;     // counter -> coefficient
+
+    // false if F has edges that cannot be instrumented (indirectbr, callbr, EH pads)
+    static bool canPlaceOnEdges(Function & F) {
+        for (BasicBlock & B : F) {
+            if (B.isEHPad() || isa<IndirectBrInst>(B.getTerminator()) || isa<CallBrInst>(B.getTerminator()))
+                return false;
+        }
+        return true;
+    }
+
+    /*
+     * Place the counters of F, numbered from firstCounter; returns the number of counters used.
+     * spanningTree = false (or a function canPlaceOnEdges rejects) gives one counter per block.
+     */
+    unsigned place(Function & F, unsigned firstCounter, bool spanningTree) {
+        edges.clear();
+        edgeIndex.clear();
+        blockCounts.clear();
+        onEdges = spanningTree && canPlaceOnEdges(F);
+
+        if (!onEdges) {
+            unsigned counter = firstCounter;
+            for (BasicBlock & B : F)
+                blockCounts[&B][counter++] = 1;
+            return counter - firstCounter;
+        }
+
+        // nodes: 0 is V, then the blocks
+        map<BasicBlock *, unsigned> node;
+        for (BasicBlock & B : F) {
+            unsigned id = node.size() + 1;
+            node[&B] = id;
+        }
+
+        DominatorTree DT(F);
+        LoopInfo LI(DT);
+        auto weight = [&](BasicBlock * src, BasicBlock * dst) -> uint64_t {
+            unsigned depth = std::min(src ? LI.getLoopDepth(src) : 0, dst ? LI.getLoopDepth(dst) : 0);
+            return uint64_t(1) << (3 * std::min(depth, 20u));
+        };
+
+        addEdge(nullptr, &F.getEntryBlock(), weight(nullptr, &F.getEntryBlock()));
+        for (BasicBlock & B : F) {
+            if (succ_begin(&B) == succ_end(&B))
+                addEdge(&B, nullptr, weight(&B, nullptr));
+            for (BasicBlock * succ : successors(&B)) {
+                if (edgeIndex.count(make_pair(&B, succ)) == 0)
+                    addEdge(&B, succ, weight(&B, succ));
+            }
+        }
+
+        // Kruskal: the heaviest edges first, an edge joining two trees joins the spanning tree
+        vector<unsigned> order(edges.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+            return edges[a].weight > edges[b].weight;
+        });
+        vector<unsigned> parent(node.size() + 1);
+        std::iota(parent.begin(), parent.end(), 0);
+        auto find = [&](unsigned x) {
+            while (parent[x] != x)
+                x = parent[x] = parent[parent[x]];
+            return x;
+        };
+        auto nodeOf = [&](BasicBlock * B) { return B ? node[B] : 0; };
+
+        unsigned counter = firstCounter;
+        for (unsigned e : order) {
+            unsigned a = find(nodeOf(edges[e].src));
+            unsigned b = find(nodeOf(edges[e].dst));
+            if (a != b) {
+                parent[a] = b;
+                continue;
+            }
+            edges[e].counted = true;
+            edges[e].counter = counter;
+            edges[e].count[counter++] = 1;
+            edges[e].known = true;
+        }
+
+        // the tree edges, from the leaves: a node with one unknown edge left gives that edge by flow conservation
+        vector<vector<unsigned>> incident(node.size() + 1);
+        vector<unsigned> unknown(node.size() + 1, 0);
+        for (unsigned e = 0; e < edges.size(); e++) {
+            unsigned a = nodeOf(edges[e].src), b = nodeOf(edges[e].dst);
+            incident[a].push_back(e);
+            incident[b].push_back(e);
+            if (!edges[e].known) {
+                unknown[a]++;
+                unknown[b]++;
+            }
+        }
+        deque<unsigned> leaves;
+        for (unsigned n = 0; n < incident.size(); n++) {
+            if (unknown[n] == 1)
+                leaves.push_back(n);
+        }
+        while (!leaves.empty()) {
+            unsigned n = leaves.front();
+            leaves.pop_front();
+            if (unknown[n] != 1)
+                continue;
+
+            unsigned missing = 0;
+            for (unsigned e : incident[n]) {
+                if (!edges[e].known)
+                    missing = e;
+            }
+            // in(n) = out(n); the missing edge is the difference of the other edges
+            bool missingEntersN = nodeOf(edges[missing].dst) == n;
+            Combination count;
+            for (unsigned e : incident[n]) {
+                // a self loop enters and leaves n: it cancels out
+                if (e == missing || edges[e].src == edges[e].dst)
+                    continue;
+                bool entersN = nodeOf(edges[e].dst) == n;
+                add(count, edges[e].count, entersN == missingEntersN ? -1 : 1);
+            }
+            edges[missing].count = count;
+            edges[missing].known = true;
+
+            unsigned a = nodeOf(edges[missing].src), b = nodeOf(edges[missing].dst);
+            for (unsigned end : {a, b}) {
+                if (--unknown[end] == 1)
+                    leaves.push_back(end);
+            }
+        }
+
+        for (Edge & edge : edges) {
+            if (edge.dst)
+                add(blockCounts[edge.dst], edge.count, 1);
+        }
+        return counter - firstCounter;
+    }
+
+    // the execution count of B
+    Combination blockCount(BasicBlock * B) const {
+        auto it = blockCounts.find(B);
+        return it == blockCounts.end() ? Combination() : it->second;
+    }
+
+    // the number of times control went from src to dst, nullptr if the counters do not tell
+    const Combination * edgeCount(BasicBlock * src, BasicBlock * dst) const {
+        auto it = edgeIndex.find(make_pair(src, dst));
+        return !onEdges || it == edgeIndex.end() ? nullptr : &edges[it->second].count;
+    }
+
+    /*
+     * Insert the increments of the counters into the function given to place() (counters: an array of i64, indexed
+     * by counter).
+     * The counter of an edge goes at the end of its source if the source has a single successor, at the start
+     * of its destination if the destination has a single predecessor, and in a new block splitting the edge
+     * otherwise. The counter of a block goes before its terminator.
+     */
+    void instrument(GlobalVariable * counters) {
+        if (!onEdges) {
+            for (auto const & block : blockCounts)
+                increment(block.first->getTerminator(), counters, block.second.begin()->first);
+            return;
+        }
+
+        for (Edge & edge : edges) {
+            if (!edge.counted)
+                continue;
+            if (!edge.src) {
+                increment(&*edge.dst->getFirstInsertionPt(), counters, edge.counter);
+            }
+            else if (!edge.dst || edge.src->getUniqueSuccessor()) {
+                increment(edge.src->getTerminator(), counters, edge.counter);
+            }
+            else if (edge.dst->getUniquePredecessor()) {
+                increment(&*edge.dst->getFirstInsertionPt(), counters, edge.counter);
+            }
+            else {
+                Instruction * terminator = edge.src->getTerminator();
+                unsigned successor = 0;
+                while (terminator->getSuccessor(successor) != edge.dst)
+                    successor++;
+                BasicBlock * split = SplitCriticalEdge(terminator, successor,
+                                                       CriticalEdgeSplittingOptions().setMergeIdenticalEdges());
+                increment(split->getTerminator(), counters, edge.counter);
+            }
+        }
+    }
+
+    static void increment(Instruction * before, GlobalVariable * counters, unsigned counter) {
+        IRBuilder<> irBuilder(before);
+        Type * int64 = irBuilder.getInt64Ty();
+        Value * slot = irBuilder.CreateConstInBoundsGEP2_32(counters->getValueType(), counters, 0, counter);
+        irBuilder.CreateStore(irBuilder.CreateAdd(irBuilder.CreateLoad(int64, slot), irBuilder.getInt64(1)), slot);
+    }
+
+    static void add(Combination & dst, const Combination & src, int64_t sign) {
+        for (auto const & term : src) {
+            int64_t & coefficient = dst[term.first];
+            coefficient += sign * term.second;
+            if (coefficient == 0)
+                dst.erase(term.first);
+        }
+    }
+
+  private:
+    struct Edge {
+        BasicBlock * src;       // nullptr: from V (function entry)
+        BasicBlock * dst;       // nullptr: to V (function exit)
+        uint64_t weight;
+        bool counted = false;   // not in the spanning tree
+        unsigned counter = 0;
+        bool known = false;
+        Combination count;
+    };
+
+    bool onEdges = false;
+    vector<Edge> edges;
+    map<pair<BasicBlock *, BasicBlock *>, unsigned> edgeIndex;
+    map<BasicBlock *, Combination> blockCounts;
+
+    void addEdge(BasicBlock * src, BasicBlock * dst, uint64_t weight) {
+        edgeIndex[make_pair(src, dst)] = edges.size();
+        Edge edge;
+        edge.src = src;
+        edge.dst = dst;
+        edge.weight = weight;
+        edges.push_back(edge);
+    }
+};
+
+}
+#endif // End LLVM_TRANSFORMS_COUNTERPLACEMENT_H
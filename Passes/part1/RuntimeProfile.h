@@ -0,0 +1,52 @@
+/*  Runtime Profiles
+    With CSE231_PROFILE=<file> in its environment, a program running with lib231 keeps its counts in <file> instead
+    of printing them at every ret: the file is created and mmapped when the runtime is loaded, the counts of the
+    threads are merged into it, and it is marked complete when the process exits. The counts survive a crash (the
+    mapping is shared), but such a run is not complete. "%p" in the file name is replaced by the process id, so
+    the workers of a load test write a profile each; cse231-prof-merge adds them up and prints the text format
+    of printOutInstrInfo / printOutBranchInfo. A file that exists is never truncated (other processes may have it
+    mapped): if it is a profile of the same runtime the process counts in it too (runs + 1), else it counts in
+    memory and prints as without CSE231_PROFILE.
+
+    Layout (version 1, native byte order):
+        RuntimeProfileHeader
+        char names[numOpcodes][RuntimeProfileNameSize]      llvm::Instruction::getOpcodeName() of every opcode
+        uint64_t counts[numOpcodes]
+    The opcodes are matched by name, so profiles of runtimes built against different LLVM versions merge.
+*/
+#ifndef LLVM_TRANSFORMS_RUNTIMEPROFILE_H
+#define LLVM_TRANSFORMS_RUNTIMEPROFILE_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace llvm {
+
+const char RuntimeProfileMagic[8] = {'c', 's', 'e', '2', '3', '1', 'p', 'f'};
+const uint32_t RuntimeProfileVersion = 1;
+const size_t RuntimeProfileNameSize = 24;
+
+struct RuntimeProfileHeader {
+    char magic[8];          // RuntimeProfileMagic
+    uint32_t version;       // RuntimeProfileVersion
+    uint32_t numOpcodes;
+    uint64_t runs;          // the processes merged into the profile
+    uint64_t complete;      // the ones that exited normally
+    uint64_t taken;         // conditional branches taken
+    uint64_t total;         // conditional branches executed
+};
+
+inline size_t runtimeProfileSize(uint32_t numOpcodes) {
+    return sizeof(RuntimeProfileHeader) + numOpcodes * (RuntimeProfileNameSize + sizeof(uint64_t));
+}
+
+inline char * runtimeProfileName(RuntimeProfileHeader * header, uint32_t opcode) {
+    return reinterpret_cast<char *>(header + 1) + opcode * RuntimeProfileNameSize;
+}
+
+inline uint64_t * runtimeProfileCounts(RuntimeProfileHeader * header) {
+    return reinterpret_cast<uint64_t *>(runtimeProfileName(header, header->numOpcodes));
+}
+
+}
+#endif // End LLVM_TRANSFORMS_RUNTIMEPROFILE_H
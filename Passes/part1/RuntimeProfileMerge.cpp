@@ -0,0 +1,139 @@
+/*  cse231-prof-merge
+    Adds up the profiles written by lib231 (CSE231_PROFILE=<file>, see RuntimeProfile.h), e.g. one per worker of a
+    load test, and prints the total in the text format of the runtime:
+        [opcode name]\t[count]\n ...         (printOutInstrInfo, if instructions were counted)
+        taken\t[count]\ntotal\t[count]\n     (printOutBranchInfo, if branches were counted)
+    -o also writes the merged profile, which can be merged again.
+
+    cse231-prof-merge worker.*.prof [-o merged.prof]
+*/
+#include "RuntimeProfile.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+static cl::list<string> Inputs(cl::Positional, cl::desc("<profile files>"), cl::OneOrMore);
+
+static cl::opt<string> Output("o", cl::desc("Also write the merged profile to <filename>"),
+    cl::value_desc("filename"), cl::init(""));
+
+struct MergedProfile {
+    uint64_t runs = 0, complete = 0, taken = 0, total = 0;
+    vector<pair<string, uint64_t>> counts;      // in the opcode order of the first profile
+
+    void add(const string & name, uint64_t count) {
+        for (auto & entry : counts) {
+            if (entry.first == name) {
+                entry.second += count;
+                return;
+            }
+        }
+        counts.push_back(make_pair(name, count));
+    }
+
+    // returns false and sets error if buffer is not a profile
+    bool add(const MemoryBuffer & buffer, string & error) {
+        size_t size = buffer.getBufferSize();
+        RuntimeProfileHeader header;
+        if (size < sizeof(header)) {
+            error = "truncated";
+            return false;
+        }
+        memcpy(&header, buffer.getBufferStart(), sizeof(header));
+        if (memcmp(header.magic, RuntimeProfileMagic, sizeof(header.magic)) != 0) {
+            error = "not a cse231 profile";
+            return false;
+        }
+        if (header.version != RuntimeProfileVersion) {
+            error = "unsupported version " + to_string(header.version);
+            return false;
+        }
+        if (size != runtimeProfileSize(header.numOpcodes)) {
+            error = "truncated";
+            return false;
+        }
+
+        runs += header.runs;
+        complete += header.complete;
+        taken += header.taken;
+        total += header.total;
+        const char * names = buffer.getBufferStart() + sizeof(header);
+        const char * values = names + header.numOpcodes * RuntimeProfileNameSize;
+        for (uint32_t opcode = 0; opcode < header.numOpcodes; opcode++) {
+            uint64_t count;
+            memcpy(&count, values + opcode * sizeof(count), sizeof(count));
+            const char * name = names + opcode * RuntimeProfileNameSize;
+            add(string(name, strnlen(name, RuntimeProfileNameSize)), count);
+        }
+        return true;
+    }
+
+    void print(raw_ostream & out) const {
+        for (auto const & entry : counts) {
+            if (entry.second)
+                out << entry.first << "\t" << entry.second << "\n";
+        }
+        if (total)
+            out << "taken\t" << taken << "\n" << "total\t" << total << "\n";
+    }
+
+    bool write(StringRef path, string & error) const {
+        vector<char> data(runtimeProfileSize(counts.size()), 0);
+        RuntimeProfileHeader * header = reinterpret_cast<RuntimeProfileHeader *>(data.data());
+        memcpy(header->magic, RuntimeProfileMagic, sizeof(header->magic));
+        header->version = RuntimeProfileVersion;
+        header->numOpcodes = counts.size();
+        header->runs = runs;
+        header->complete = complete;
+        header->taken = taken;
+        header->total = total;
+        for (uint32_t opcode = 0; opcode < counts.size(); opcode++) {
+            strncpy(runtimeProfileName(header, opcode), counts[opcode].first.c_str(), RuntimeProfileNameSize - 1);
+            runtimeProfileCounts(header)[opcode] = counts[opcode].second;
+        }
+
+        std::error_code EC;
+        raw_fd_ostream out(path, EC, sys::fs::OF_None);
+        if (EC) {
+            error = path.str() + ": " + EC.message();
+            return false;
+        }
+        out.write(data.data(), data.size());
+        return true;
+    }
+};
+
+int main(int argc, char ** argv) {
+    cl::ParseCommandLineOptions(argc, argv, "cse231 runtime profile merge\n");
+
+    MergedProfile merged;
+    for (const string & input : Inputs) {
+        ErrorOr<unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(input, -1, false);
+        string error;
+        if (!buffer)
+            error = buffer.getError().message();
+        if (!buffer || !merged.add(**buffer, error)) {
+            errs() << argv[0] << ": " << input << ": " << error << "\n";
+            return 1;
+        }
+    }
+    if (merged.complete != merged.runs)
+        errs() << argv[0] << ": " << merged.runs - merged.complete << " of " << merged.runs
+               << " runs did not exit normally, their counts stop where they died\n";
+
+    merged.print(outs());
+    string error;
+    if (!Output.empty() && !merged.write(Output, error)) {
+        errs() << argv[0] << ": " << error << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,248 @@
+/*  Thread-local Counters
+    The inline counters (CounterPlacement.h, BurstSampling.h) are incremented with a plain load/add/store, which
+    loses counts when several threads run the instrumented code. Each thread therefore counts in its own copy of
+    the array (thread_local, prefix.counters): the hot path stays a load/add/store and shares nothing.
+
+    A thread that exits adds its copy into prefix.shared (atomic adds) in prefix.exit, the destructor of the
+    pthread key prefix.key (created by a constructor of the module). A thread sets its value of the key, which
+    makes pthreads call prefix.exit when the thread exits, the first time it enters a function that can start a
+    thread: one that is visible outside the module or whose address is taken. The check costs a thread-local load
+    and a branch at the entry of these functions only. pthreads do not call key destructors for the main thread
+    when the process exits: its counts are flushed when main returns. The pthread functions are weak references,
+    so a program that does not link pthreads has no key and does not register.
+
+    A flush calls prefix.collect first, which moves the counts of the exited threads from prefix.shared into the
+    copy of the calling thread (atomic exchanges), then reads and resets that copy: it sees the counts of the
+    calling thread and of the threads that exited since the last flush. The counts of the threads still running
+    are not seen.
+*/
+#ifndef LLVM_TRANSFORMS_THREADCOUNTERS_H
+#define LLVM_TRANSFORMS_THREADCOUNTERS_H
+
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include <set>
+#include <vector>
+
+using namespace std;
+
+namespace llvm {
+
+class ThreadCounters {
+  public:
+    GlobalVariable * counters = nullptr;    // the copy of the calling thread: [numCounters x i64], thread_local
+
+    /*
+     * Create the counters of M, named prefix.*, and the functions moving them between the threads.
+     */
+    void init(Module & M, StringRef prefix, unsigned numCounters) {
+        LLVMContext & context = M.getContext();
+        Type * int64 = Type::getInt64Ty(context);
+        Type * int1 = Type::getInt1Ty(context);
+        ArrayType * countersType = ArrayType::get(int64, numCounters);
+        counters = new GlobalVariable(M, countersType, false, GlobalValue::InternalLinkage,
+                                      ConstantAggregateZero::get(countersType), prefix + ".counters", nullptr,
+                                      GlobalValue::GeneralDynamicTLSModel);
+        // no more than 8: the JIT of lli does not align thread_local data further, and vector stores would fault
+#if LLVM_VERSION_MAJOR >= 10
+        counters->setAlignment(MaybeAlign(8));
+#else
+        counters->setAlignment(8);
+#endif
+        shared = new GlobalVariable(M, countersType, false, GlobalValue::InternalLinkage,
+                                    ConstantAggregateZero::get(countersType), prefix + ".shared");
+        registered = new GlobalVariable(M, int1, false, GlobalValue::InternalLinkage, ConstantInt::getFalse(context),
+                                        prefix + ".registered", nullptr, GlobalValue::GeneralDynamicTLSModel);
+
+        entries.clear();
+        for (Function & F : M) {
+            if (!F.isDeclaration() && (!F.hasLocalLinkage() || F.hasAddressTaken()))
+                entries.insert(&F);
+        }
+
+        // exit(i8*): shared += counters; counters = 0
+        Function * exitFunc = Function::Create(FunctionType::get(Type::getVoidTy(context), {Type::getInt8PtrTy(context)}, false),
+                                               GlobalValue::InternalLinkage, prefix + ".exit", &M);
+        forEachCounter(exitFunc, [&](IRBuilder<> & irBuilder, Value * mine, Value * theirs, BasicBlock * next) {
+            Value * count = irBuilder.CreateLoad(int64, mine);
+            BasicBlock * merge = BasicBlock::Create(context, "merge", exitFunc, next);
+            irBuilder.CreateCondBr(irBuilder.CreateICmpEQ(count, irBuilder.getInt64(0)), next, merge);
+            irBuilder.SetInsertPoint(merge);
+            atomic(irBuilder, AtomicRMWInst::Add, theirs, count);
+            irBuilder.CreateStore(irBuilder.getInt64(0), mine);
+            irBuilder.CreateBr(next);
+        });
+
+        // collect(): counters += shared; shared = 0
+        collectFunc = Function::Create(FunctionType::get(Type::getVoidTy(context), false), GlobalValue::InternalLinkage,
+                                       prefix + ".collect", &M);
+        forEachCounter(collectFunc, [&](IRBuilder<> & irBuilder, Value * mine, Value * theirs, BasicBlock * next) {
+            BasicBlock * take = BasicBlock::Create(context, "take", collectFunc, next);
+            irBuilder.CreateCondBr(irBuilder.CreateICmpEQ(atomicLoad(irBuilder, theirs), irBuilder.getInt64(0)), next, take);
+            irBuilder.SetInsertPoint(take);
+            Value * count = atomic(irBuilder, AtomicRMWInst::Xchg, theirs, irBuilder.getInt64(0));
+            irBuilder.CreateStore(irBuilder.CreateAdd(irBuilder.CreateLoad(int64, mine), count), mine);
+            irBuilder.CreateBr(next);
+        });
+
+        // constructor: threaded = pthread_key_create && pthread_key_create(&key, exit) == 0
+        Type * int32 = Type::getInt32Ty(context);
+        Type * int8Ptr = Type::getInt8PtrTy(context);
+        auto weak = [&](StringRef name, FunctionType * type) {
+            FunctionCallee callee = M.getOrInsertFunction(name, type);
+            Function * function = dyn_cast<Function>(callee.getCallee());
+            if (function && function->isDeclaration() && function->use_empty())
+                function->setLinkage(GlobalValue::ExternalWeakLinkage);
+            return callee;
+        };
+        GlobalVariable * key = new GlobalVariable(M, int32, false, GlobalValue::InternalLinkage,
+                                                  ConstantInt::get(int32, 0), prefix + ".key");
+        GlobalVariable * threaded = new GlobalVariable(M, int1, false, GlobalValue::InternalLinkage,
+                                                       ConstantInt::getFalse(context), prefix + ".threaded");
+        FunctionCallee keyCreateFunc = weak("pthread_key_create",
+            FunctionType::get(int32, {PointerType::getUnqual(int32), exitFunc->getType()}, false));
+        FunctionCallee setSpecificFunc = weak("pthread_setspecific", FunctionType::get(int32, {int32, int8Ptr}, false));
+
+        Function * ctor = Function::Create(FunctionType::get(Type::getVoidTy(context), false), GlobalValue::InternalLinkage,
+                                           prefix + ".init", &M);
+        BasicBlock * ctorEntry = BasicBlock::Create(context, "entry", ctor);
+        BasicBlock * create = BasicBlock::Create(context, "create", ctor);
+        BasicBlock * ctorDone = BasicBlock::Create(context, "done", ctor);
+        IRBuilder<> irBuilder(ctorEntry);
+        irBuilder.CreateCondBr(irBuilder.CreateIsNull(keyCreateFunc.getCallee()), ctorDone, create);
+        irBuilder.SetInsertPoint(create);
+        Value * created = irBuilder.CreateCall(keyCreateFunc, {key, exitFunc});
+        irBuilder.CreateStore(irBuilder.CreateICmpEQ(created, irBuilder.getInt32(0)), threaded);
+        irBuilder.CreateBr(ctorDone);
+        irBuilder.SetInsertPoint(ctorDone);
+        irBuilder.CreateRetVoid();
+        appendToGlobalCtors(M, ctor, 0);
+
+        // register(): registered = true; if (threaded) pthread_setspecific(key, non-null)
+        registerFunc = Function::Create(FunctionType::get(Type::getVoidTy(context), false), GlobalValue::InternalLinkage,
+                                        prefix + ".register", &M);
+        registerFunc->addFnAttr(Attribute::NoInline);
+        registerFunc->addFnAttr(Attribute::Cold);
+        BasicBlock * registerEntry = BasicBlock::Create(context, "entry", registerFunc);
+        BasicBlock * setKey = BasicBlock::Create(context, "set", registerFunc);
+        BasicBlock * registerDone = BasicBlock::Create(context, "done", registerFunc);
+        irBuilder.SetInsertPoint(registerEntry);
+        irBuilder.CreateStore(irBuilder.getTrue(), registered);
+        irBuilder.CreateCondBr(irBuilder.CreateLoad(int1, threaded), setKey, registerDone);
+        irBuilder.SetInsertPoint(setKey);
+        irBuilder.CreateCall(setSpecificFunc, {irBuilder.CreateLoad(int32, key), irBuilder.CreatePointerCast(shared, int8Ptr)});
+        irBuilder.CreateBr(registerDone);
+        irBuilder.SetInsertPoint(registerDone);
+        irBuilder.CreateRetVoid();
+    }
+
+    /*
+     * If F can start a thread, register the thread at the entry of F (after its static allocas):
+     *     if (!registered) register();
+     * Call it once F is instrumented.
+     */
+    void enter(Function & F) {
+        if (!entries.count(&F))
+            return;
+        BasicBlock & entry = F.getEntryBlock();
+        vector<AllocaInst *> staticAllocas;
+        for (Instruction & I : entry) {
+            AllocaInst * alloca = dyn_cast<AllocaInst>(&I);
+            if (alloca && alloca->isStaticAlloca())
+                staticAllocas.push_back(alloca);
+        }
+        Instruction * start = &*entry.getFirstInsertionPt();
+        for (AllocaInst * alloca : staticAllocas) {
+            if (alloca == start)
+                start = alloca->getNextNode();
+            else
+                alloca->moveBefore(start);
+        }
+
+        IRBuilder<> irBuilder(start);
+        Value * unregistered = irBuilder.CreateNot(irBuilder.CreateLoad(irBuilder.getInt1Ty(), registered));
+        MDBuilder MDB(F.getContext());
+        Instruction * then = SplitBlockAndInsertIfThen(unregistered, start, false, MDB.createBranchWeights(1, 1 << 20));
+        irBuilder.SetInsertPoint(then);
+        irBuilder.CreateCall(registerFunc);
+    }
+
+    // take the counts of the exited threads into counters (the start of a flush)
+    void collect(IRBuilder<> & irBuilder) {
+        irBuilder.CreateCall(collectFunc);
+    }
+
+    // a monotonic atomicrmw on an i64
+    static Value * atomic(IRBuilder<> & irBuilder, AtomicRMWInst::BinOp op, Value * ptr, Value * value) {
+#if LLVM_VERSION_MAJOR >= 13
+        return irBuilder.CreateAtomicRMW(op, ptr, value, MaybeAlign(8), AtomicOrdering::Monotonic);
+#else
+        return irBuilder.CreateAtomicRMW(op, ptr, value, AtomicOrdering::Monotonic);
+#endif
+    }
+
+  private:
+    GlobalVariable * shared = nullptr;      // the counts of the exited threads
+    GlobalVariable * registered = nullptr;  // thread_local: the thread registered prefix.exit
+    Function * collectFunc = nullptr;
+    Function * registerFunc = nullptr;
+    set<Function *> entries;                // the functions that can start a thread
+
+    static Value * atomicLoad(IRBuilder<> & irBuilder, Value * ptr) {
+        LoadInst * load = irBuilder.CreateLoad(irBuilder.getInt64Ty(), ptr);
+#if LLVM_VERSION_MAJOR >= 10
+        load->setAlignment(Align(8));
+#else
+        load->setAlignment(8);
+#endif
+        load->setAtomic(AtomicOrdering::Monotonic);
+        return load;
+    }
+
+    /*
+     * The body of F: a loop over the counters, body(irBuilder, &counters[c], &shared[c], next) ending in a branch
+     * to next.
+     */
+    template <typename Body>
+    void forEachCounter(Function * F, Body body) {
+        LLVMContext & context = F->getContext();
+        Type * int32 = Type::getInt32Ty(context);
+        unsigned numCounters = cast<ArrayType>(counters->getValueType())->getNumElements();
+        BasicBlock * entry = BasicBlock::Create(context, "entry", F);
+        BasicBlock * head = BasicBlock::Create(context, "counter", F);
+        BasicBlock * start = BasicBlock::Create(context, "counter.body", F);
+        BasicBlock * next = BasicBlock::Create(context, "counter.next", F);
+        BasicBlock * done = BasicBlock::Create(context, "done", F);
+
+        IRBuilder<> irBuilder(entry);
+        irBuilder.CreateBr(head);
+
+        irBuilder.SetInsertPoint(head);
+        PHINode * c = irBuilder.CreatePHI(int32, 2, "c");
+        c->addIncoming(irBuilder.getInt32(0), entry);
+        irBuilder.CreateCondBr(irBuilder.CreateICmpULT(c, irBuilder.getInt32(numCounters)), start, done);
+
+        irBuilder.SetInsertPoint(start);
+        Value * mine = irBuilder.CreateInBoundsGEP(counters->getValueType(), counters, {irBuilder.getInt32(0), c});
+        Value * theirs = irBuilder.CreateInBoundsGEP(shared->getValueType(), shared, {irBuilder.getInt32(0), c});
+        body(irBuilder, mine, theirs, next);
+
+        irBuilder.SetInsertPoint(next);
+        c->addIncoming(irBuilder.CreateAdd(c, irBuilder.getInt32(1)), next);
+        irBuilder.CreateBr(head);
+
+        irBuilder.SetInsertPoint(done);
+        irBuilder.CreateRetVoid();
+    }
+};
+
+}
+#endif // End LLVM_TRANSFORMS_THREADCOUNTERS_H
@@ -0,0 +1,303 @@
+/*
+the runtime of the programs instrumented by cse231-cdi and cse231-bb (lib231.so):
+    void updateInstrInfo(unsigned num, uint32_t * keys, uint32_t * values)    adds values[i] to the count of opcode keys[i]
+    void updateInstrInfo64(unsigned num, uint32_t * keys, uint64_t * values)  the same, with 64-bit counts
+    void printOutInstrInfo()                                                  prints [opcode name]\t[count]\n, resets the counts
+    void updateBranchInfo(bool taken)                                         counts a conditional branch, taken or not
+    void updateBranchInfoN(uint64_t taken, uint64_t total)                    counts total conditional branches, taken of them taken
+    void printOutBranchInfo()                                                 prints taken\t[count]\ntotal\t[count]\n, resets the counts
+EX
+    lli -load=lib231.so instrumented.bc
+
+Multi-threaded programs: the update functions are called for every block / branch executed, by every thread. Each
+thread counts in its own shard (thread_local, a plain array indexed by opcode), so the hot path takes no lock and
+shares no cache line. A shard is merged into the process totals (atomic adds) when its thread exits and when the
+thread prints; printing prints and resets the totals, so it reports the calling thread and the threads that exited
+since the last print. The counts merged after the last print (threads exiting late) are printed at process exit.
+The threads still running at process exit are not counted.
+
+Profile files: with CSE231_PROFILE=<file> in the environment, the totals live in <file> (RuntimeProfile.h), mmapped
+when the runtime is loaded; the print functions merge the calling thread but neither print nor reset, and the
+profile is marked complete at process exit. The processes sharing <file> count in it together; it is never
+truncated. cse231-prof-merge prints the text format of one or many profiles.
+*/
+
+#include "RuntimeProfile.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace llvm;
+using namespace std;
+
+namespace {
+    // the opcode numbers of llvm::Instruction, from Instruction.def: the runtime does not link LLVM
+    enum Opcode : unsigned {
+#define HANDLE_INST(num, opcode, Class) Opcode##opcode = num,
+#define LAST_OTHER_INST(num) NumOpcodes = num + 1
+#include "llvm/IR/Instruction.def"
+    };
+
+    // the name llvm::Instruction::getOpcodeName() gives an opcode
+    const char* opcodeName(unsigned opcode){
+        static const vector<string> names = []{
+            vector<string> names(NumOpcodes, "<Invalid operator> ");
+            auto lower = [](string name){
+                for (char &c : name){
+                    c = tolower(c);
+                }
+                return name;
+            };
+#define HANDLE_INST(num, opcode, Class) names[num] = lower(#opcode);
+#include "llvm/IR/Instruction.def"
+            // the names that are not the opcode in lower case
+            names[OpcodeAtomicCmpXchg] = "cmpxchg";
+            names[OpcodeVAArg] = "va_arg";
+            names[OpcodeUserOp1] = names[OpcodeUserOp2] = "<Invalid operator> ";
+            return names;
+        }();
+        return names[opcode].c_str();
+    }
+
+    // the counts of the process, merged from the shards (atomically): in memory, or in the profile file
+    uint64_t memoryInstr[NumOpcodes];
+    uint64_t memoryBranch[2];
+    uint64_t* instrTotals = memoryInstr;
+    uint64_t* branchTotals = memoryBranch;      // taken, total
+    RuntimeProfileHeader* profile = nullptr;
+
+    void* mapShared(int fd, size_t size){
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        return mapping == MAP_FAILED ? nullptr : mapping;
+    }
+
+    /*
+    A profile is never truncated once it exists: the processes sharing its name have it mapped, and would fault.
+    A new profile is built under a temporary name and linked into place, so no process sees it half-written; an
+    existing one is checked to be a profile of this runtime and counted in as well (the adds are atomic).
+    */
+    // nullptr and error set if the profile cannot be created, nullptr and no error if it exists
+    RuntimeProfileHeader* createProfile(const string& path, string& error){
+        size_t size = runtimeProfileSize(NumOpcodes);
+        string temporary = path + ".tmp." + to_string(getpid());
+        int fd = open(temporary.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0){
+            error = strerror(errno);
+            return nullptr;
+        }
+        RuntimeProfileHeader* header = nullptr;
+        if (ftruncate(fd, size) == 0){
+            header = static_cast<RuntimeProfileHeader*>(mapShared(fd, size));
+        }
+        if (!header){
+            error = strerror(errno);
+        }
+        close(fd);
+
+        if (header){
+            memcpy(header->magic, RuntimeProfileMagic, sizeof(header->magic));
+            header->version = RuntimeProfileVersion;
+            header->numOpcodes = NumOpcodes;
+            for (unsigned opcode = 0; opcode < NumOpcodes; opcode++){
+                strncpy(runtimeProfileName(header, opcode), opcodeName(opcode), RuntimeProfileNameSize - 1);
+            }
+            if (link(temporary.c_str(), path.c_str()) != 0){
+                if (errno != EEXIST){
+                    error = strerror(errno);
+                }
+                munmap(header, size);
+                header = nullptr;
+            }
+        }
+        unlink(temporary.c_str());
+        return header;
+    }
+
+    RuntimeProfileHeader* openProfile(const string& path, string& error){
+        size_t size = runtimeProfileSize(NumOpcodes);
+        int fd = open(path.c_str(), O_RDWR);
+        if (fd < 0){
+            error = strerror(errno);
+            return nullptr;
+        }
+        struct stat status;
+        RuntimeProfileHeader* header = nullptr;
+        if (fstat(fd, &status) != 0){
+            error = strerror(errno);
+        }
+        else if ((size_t) status.st_size != size){
+            error = "exists and is not a profile of this runtime";
+        }
+        else if (!(header = static_cast<RuntimeProfileHeader*>(mapShared(fd, size)))){
+            error = strerror(errno);
+        }
+        close(fd);
+
+        bool matches = header && memcmp(header->magic, RuntimeProfileMagic, sizeof(header->magic)) == 0
+                       && header->version == RuntimeProfileVersion && header->numOpcodes == NumOpcodes;
+        for (unsigned opcode = 0; matches && opcode < NumOpcodes; opcode++){
+            matches = strncmp(runtimeProfileName(header, opcode), opcodeName(opcode), RuntimeProfileNameSize) == 0;
+        }
+        if (header && !matches){
+            munmap(header, size);
+            header = nullptr;
+            error = "exists and is not a profile of this runtime";
+        }
+        return header;
+    }
+
+    // CSE231_PROFILE: map the profile file and count in it
+    struct ProfileFile {
+        ProfileFile(){
+            const char* pattern = getenv("CSE231_PROFILE");
+            if (!pattern || !*pattern){
+                return;
+            }
+            string path;
+            for (const char* c = pattern; *c; c++){
+                if (c[0] == '%' && c[1] == 'p'){
+                    path += to_string(getpid());
+                    c++;
+                }
+                else{
+                    path += *c;
+                }
+            }
+
+            string error;
+            RuntimeProfileHeader* header = createProfile(path, error);
+            if (!header && error.empty()){
+                header = openProfile(path, error);
+            }
+            if (!header){
+                fprintf(stderr, "lib231: cannot map the profile %s: %s\n", path.c_str(), error.c_str());
+                return;
+            }
+
+            profile = header;
+            __atomic_fetch_add(&profile->runs, 1, __ATOMIC_RELAXED);
+            instrTotals = runtimeProfileCounts(profile);
+            branchTotals = &profile->taken;
+        }
+    };
+    ProfileFile profileFile;
+
+    // the counts of one thread since its last merge
+    struct Shard {
+        uint64_t instr[NumOpcodes] = {};
+        uint64_t branch[2] = {};
+
+        void merge(){
+            for (unsigned opcode = 0; opcode < NumOpcodes; opcode++){
+                if (instr[opcode]){
+                    __atomic_fetch_add(&instrTotals[opcode], instr[opcode], __ATOMIC_RELAXED);
+                    instr[opcode] = 0;
+                }
+            }
+            for (unsigned i = 0; i < 2; i++){
+                if (branch[i]){
+                    __atomic_fetch_add(&branchTotals[i], branch[i], __ATOMIC_RELAXED);
+                    branch[i] = 0;
+                }
+            }
+        }
+
+        // thread exit
+        ~Shard(){
+            merge();
+        }
+    };
+    thread_local Shard shard;
+
+    void printInstr(){
+        for (unsigned opcode = 0; opcode < NumOpcodes; opcode++){
+            uint64_t count = __atomic_exchange_n(&instrTotals[opcode], 0, __ATOMIC_RELAXED);
+            if (count){
+                fprintf(stderr, "%s\t%llu\n", opcodeName(opcode), (unsigned long long) count);
+            }
+        }
+    }
+
+    void printBranch(){
+        uint64_t taken = __atomic_exchange_n(&branchTotals[0], 0, __ATOMIC_RELAXED);
+        uint64_t total = __atomic_exchange_n(&branchTotals[1], 0, __ATOMIC_RELAXED);
+        fprintf(stderr, "taken\t%llu\n", (unsigned long long) taken);
+        fprintf(stderr, "total\t%llu\n", (unsigned long long) total);
+    }
+
+    // process exit: the thread_local shards of the exiting thread are destroyed (merged) before this runs
+    struct ExitReport {
+        ~ExitReport(){
+            if (profile){
+                // the mapping stays: the threads still running may merge into it
+                __atomic_fetch_add(&profile->complete, 1, __ATOMIC_RELAXED);
+                msync(profile, runtimeProfileSize(NumOpcodes), MS_ASYNC);
+                return;
+            }
+            printInstr();
+            if (__atomic_load_n(&branchTotals[1], __ATOMIC_RELAXED)){
+                printBranch();
+            }
+        }
+    };
+    ExitReport exitReport;
+}
+
+extern "C" {
+
+void updateInstrInfo(unsigned num, uint32_t * keys, uint32_t * values){
+    Shard &local = shard;
+    for (unsigned i = 0; i < num; i++){
+        if (keys[i] < NumOpcodes){
+            local.instr[keys[i]] += values[i];
+        }
+    }
+}
+
+void updateInstrInfo64(unsigned num, uint32_t * keys, uint64_t * values){
+    Shard &local = shard;
+    for (unsigned i = 0; i < num; i++){
+        if (keys[i] < NumOpcodes){
+            local.instr[keys[i]] += values[i];
+        }
+    }
+}
+
+void printOutInstrInfo(){
+    shard.merge();
+    if (!profile){
+        printInstr();
+    }
+}
+
+void updateBranchInfo(bool taken){
+    Shard &local = shard;
+    local.branch[0] += taken;
+    local.branch[1]++;
+}
+
+void updateBranchInfoN(uint64_t taken, uint64_t total){
+    Shard &local = shard;
+    local.branch[0] += taken;
+    local.branch[1] += total;
+}
+
+void printOutBranchInfo(){
+    shard.merge();
+    if (!profile){
+        printBranch();
+    }
+}
+
+}